@@ -2,13 +2,14 @@
 
 #include <string>
 #include <vector>
+#include <string_view>
 
 #include "glob.hpp"
 #include "tasks.hpp"
 
 TinyWDeclStart
 
-inline const uint8_t *BytesOf_File_tinyc_h = (uint8_t*)R"(#ifndef __LIB_TINYC_H__
+inline constexpr std::string_view BytesOf_File_tinyc_h = R"(#ifndef __LIB_TINYC_H__
 #define __LIB_TINYC_H__
 
 #include <stdint.h>
@@ -31,6 +32,288 @@ inline const uint8_t *BytesOf_File_tinyc_h = (uint8_t*)R"(#ifndef __LIB_TINYC_H_
 
 typedef uint8_t*(*Tfunc_MemoryGetPointer)();
 typedef uint64_t(*Tfunc_MemoryGetSize)();
+typedef void(*Tfunc_MemoryLoadImage)(uint8_t*, uint64_t, uint64_t);
+
+/* Memory ABI v2: the memory module describes guest RAM once, as a table of 
+ * regions, and the CPU reads/writes through `base` directly. */
+#define TINYW_MEM_MAP_VERSION 2
+
+#define TINYW_REGION_READ  0x1u
+#define TINYW_REGION_WRITE 0x2u
+#define TINYW_REGION_EXEC  0x4u
+#define TINYW_REGION_MMIO  0x8u  /* accesses have side effects: never cache or batch */
+#define TINYW_REGION_RO    (TINYW_REGION_READ)
+#define TINYW_REGION_RW    (TINYW_REGION_READ | TINYW_REGION_WRITE)
+
+typedef struct tinyw_mem_region {
+  uint8_t *base;        /* host address of the first byte */
+  uint64_t guest_addr;  /* guest address `base` is mapped at */
+  uint64_t size;        /* in bytes */
+  uint32_t flags;       /* TINYW_REGION_* */
+  uint32_t page_size;   /* backing page size, in bytes */
+} tinyw_mem_region;
+
+typedef struct tinyw_mem_map {
+  uint32_t version;     /* TINYW_MEM_MAP_VERSION */
+  uint32_t count;
+  const tinyw_mem_region *regions;
+} tinyw_mem_map;
+
+typedef const tinyw_mem_map*(*Tfunc_MemoryGetMap)();
+typedef void(*Tfunc_MemoryAttach)(uint8_t*, uint64_t, uint32_t);
+
+/* Host-owned CPU -> GPU command queue (single producer: the CPU thread). 
+ * Every successful push reaches the GPU module's `send_bytes` as one call, 
+ * in order, from a host drain thread. */
+#define TINYW_QUEUE_OK      0
+#define TINYW_QUEUE_DROPPED 1  /* full (drop policy) or larger than half the ring */
+#define TINYW_QUEUE_CLOSED  2  /* the VM is shutting down */
+
+typedef struct tinyw_gpu_queue {
+  void *ctx;
+  int32_t (*push)(void *ctx, const uint8_t *bytes, uint64_t len);
+} tinyw_gpu_queue;
+
+/* Cooperative stop: the host sets `*flag` (and signals `event_fd`, an eventfd 
+ * on Linux, -1 elsewhere) once the VM must shut down — the other module 
+ * failed, the CPU finished, or a `-core timeout`/`-core cpu-limit` expired. 
+ * Long-running loops should poll `tinyw_stop_requested` and return. */
+typedef struct tinyw_stop_token {
+  const uint32_t *flag;
+  int32_t event_fd;
+} tinyw_stop_token;
+
+#if defined(_MSC_VER)
+static inline int tinyw_stop_requested(const tinyw_stop_token *token) { 
+  return *(const volatile uint32_t*)token->flag != 0; 
+}
+#else
+static inline int tinyw_stop_requested(const tinyw_stop_token *token) { 
+  return __atomic_load_n(token->flag, __ATOMIC_RELAXED) != 0; 
+}
+#endif
+
+/* SMP: with `-cpu count N` the host runs N cores over one CPU module and one 
+ * guest memory. `attach_smp` is called before `init`; each core then runs 
+ * `start_core(id)` on its own host thread and `stop_core(id)` once it returned. 
+ * Guest atomics shared between cores can go through `atomics`, implemented 
+ * by the host with sequentially consistent operations on naturally aligned 
+ * addresses. `cas` returns non-zero on success and updates `*expected` 
+ * otherwise. */
+typedef struct tinyw_atomics {
+  uint32_t (*load32)(const uint32_t *addr);
+  void     (*store32)(uint32_t *addr, uint32_t value);
+  uint32_t (*exchange32)(uint32_t *addr, uint32_t value);
+  int32_t  (*cas32)(uint32_t *addr, uint32_t *expected, uint32_t desired);
+  uint32_t (*fetch_add32)(uint32_t *addr, uint32_t value);
+  uint64_t (*load64)(const uint64_t *addr);
+  void     (*store64)(uint64_t *addr, uint64_t value);
+  uint64_t (*exchange64)(uint64_t *addr, uint64_t value);
+  int32_t  (*cas64)(uint64_t *addr, uint64_t *expected, uint64_t desired);
+  uint64_t (*fetch_add64)(uint64_t *addr, uint64_t value);
+  void     (*fence)(void);
+} tinyw_atomics;
+
+typedef struct tinyw_smp {
+  uint32_t core_count;
+  const tinyw_atomics *atomics;
+} tinyw_smp;
+
+typedef void(*Tfunc_CPUCore)(uint32_t);
+
+/* Tracing (`-core trace <file>`): events go to per-thread host buffers and 
+ * end up in a Chrome trace-event JSON file (chrome://tracing, Perfetto). 
+ * Names are copied by the host the first time it sees them, so keep them 
+ * few and fixed (string literals). Begin/end pairs must come from the 
+ * same thread. While tracing is off, 
+ * `*enabled` is zero and the helpers below cost one load and one branch. */
+#define TINYW_TRACE_BEGIN   0
+#define TINYW_TRACE_END     1
+#define TINYW_TRACE_INSTANT 2
+#define TINYW_TRACE_COUNTER 3  /* `value` is the new value of counter `name` */
+
+typedef struct tinyw_tracer {
+  const uint32_t *enabled;
+  void (*event)(uint32_t type, const char *name, int64_t value);
+} tinyw_tracer;
+
+#if defined(_MSC_VER)
+static inline int tinyw_trace_enabled(const tinyw_tracer *tracer) { 
+  return tracer && *(const volatile uint32_t*)tracer->enabled != 0; 
+}
+#else
+static inline int tinyw_trace_enabled(const tinyw_tracer *tracer) { 
+  return tracer && __atomic_load_n(tracer->enabled, __ATOMIC_RELAXED) != 0; 
+}
+#endif
+
+static inline void tinyw_trace(const tinyw_tracer *tracer, uint32_t type, const char *name, int64_t value) {
+  if (tinyw_trace_enabled(tracer)) tracer->event(type, name, value);
+}
+
+static inline void tinyw_trace_begin(const tinyw_tracer *t, const char *name) { tinyw_trace(t, TINYW_TRACE_BEGIN, name, 0); }
+static inline void tinyw_trace_end(const tinyw_tracer *t, const char *name) { tinyw_trace(t, TINYW_TRACE_END, name, 0); }
+static inline void tinyw_trace_instant(const tinyw_tracer *t, const char *name) { tinyw_trace(t, TINYW_TRACE_INSTANT, name, 0); }
+static inline void tinyw_trace_counter(const tinyw_tracer *t, const char *name, int64_t value) { tinyw_trace(t, TINYW_TRACE_COUNTER, name, value); }
+
+/* Host services: what a module would otherwise bring itself. Every module 
+ * exporting `attach_host` gets its own table before `init`, valid until the 
+ * module is unloaded. Fields are only ever appended: check `version` (or 
+ * `size`) before using a field newer than your header, and `capabilities` 
+ * before relying on a service. 
+ * `fail` is how a module reports an error without throwing across the 
+ * library boundary: the host records the first message, requests a stop 
+ * (see `stop`) and reports it once the module returned. */
+#define TINYW_HOST_SERVICES_VERSION 1
+
+#define TINYW_HOST_CAP_LOG   0x01u
+#define TINYW_HOST_CAP_CLOCK 0x02u
+#define TINYW_HOST_CAP_ALLOC 0x04u
+#define TINYW_HOST_CAP_STOP  0x08u
+#define TINYW_HOST_CAP_TRACE 0x10u  /* `tracer` is set: `-core trace` is on */
+#define TINYW_HOST_CAP_FAIL  0x20u
+
+#define TINYW_LOG_DEBUG 0
+#define TINYW_LOG_INFO  1
+#define TINYW_LOG_WARN  2
+#define TINYW_LOG_ERROR 3
+
+typedef struct tinyw_host_services {
+  uint32_t version;        /* TINYW_HOST_SERVICES_VERSION of the host */
+  uint32_t size;           /* sizeof(tinyw_host_services) of the host */
+  uint64_t capabilities;   /* TINYW_HOST_CAP_* */
+  void *ctx;               /* first argument of `log` and `fail` */
+  void (*log)(void *ctx, uint32_t level, const char *message);
+  uint64_t (*monotonic_ns)(void);
+  /* `alignment` is a power of two; returns null on failure. Memory from 
+   * `alloc` must go back through `free`, never the C library's. */
+  void *(*alloc)(uint64_t size, uint64_t alignment);
+  void (*free)(void *ptr);
+  const tinyw_stop_token *stop;
+  const tinyw_tracer *tracer;  /* null while tracing is off */
+  void (*fail)(void *ctx, const char *message);
+} tinyw_host_services;
+
+static inline void tinyw_host_log(const tinyw_host_services *host, uint32_t level, const char *message) {
+  if (host && (host->capabilities & TINYW_HOST_CAP_LOG)) host->log(host->ctx, level, message);
+}
+
+static inline void tinyw_host_fail(const tinyw_host_services *host, const char *message) {
+  if (host && (host->capabilities & TINYW_HOST_CAP_FAIL)) host->fail(host->ctx, message);
+}
+
+/* Lockstep scheduling (`-core sched lockstep`): instead of `start`, the host 
+ * calls `step` on the CPU then the GPU, in turns, on one thread. `step` runs 
+ * for about `budget` cycles and returns how many it used, or 
+ * TINYW_STEP_HALTED once the module has nothing left to run. */
+#define TINYW_STEP_HALTED UINT64_MAX
+
+typedef uint64_t(*Tfunc_Step)(uint64_t);
+
+/* Instance modules: one loaded library backs any number of VMs. The host 
+ * calls `create_instance` once per VM and passes the returned handle to the 
+ * `_i` variant of every entry point (`start_i`, `init_i`, ...), then hands 
+ * it to `destroy_instance`. Instance modules keep no global state. 
+ * Optional resources all go through `attach_i`, which returns non-zero if 
+ * the module took the resource. */
+#define TINYW_ATTACH_STOP_TOKEN  1  /* const tinyw_stop_token*  */
+#define TINYW_ATTACH_GPU_QUEUE   2  /* const tinyw_gpu_queue*   */
+#define TINYW_ATTACH_FRAMEBUFFER 3  /* const tinyw_framebuffer* */
+#define TINYW_ATTACH_SMP         4  /* const tinyw_smp*         */
+#define TINYW_ATTACH_TRACER      5  /* const tinyw_tracer*      */
+#define TINYW_ATTACH_HOST        6  /* const tinyw_host_services* */
+
+typedef void *tinyw_instance;
+typedef tinyw_instance(*Tfunc_CreateInstance)(void);
+typedef void(*Tfunc_DestroyInstance)(tinyw_instance);
+typedef int32_t(*Tfunc_AttachInstance)(tinyw_instance, uint32_t, const void*);
+
+/* Shared framebuffer: a window of guest memory the GPU reads in place. The 
+ * CPU draws into `base` and calls `tinyw_fb_present` once a frame is complete; 
+ * the GPU renders whenever `tinyw_fb_sequence` moved. */
+#define TINYW_FB_FORMAT_RGBA8888 1
+#define TINYW_FB_FORMAT_BGRA8888 2
+#define TINYW_FB_FORMAT_RGB565   3
+#define TINYW_FB_FORMAT_INDEX8   4
+
+typedef struct tinyw_framebuffer {
+  uint8_t  *base;        /* host address of pixel (0, 0) */
+  uint64_t  guest_addr;
+  uint32_t  width;
+  uint32_t  height;
+  uint32_t  stride;      /* bytes per row */
+  uint32_t  format;      /* TINYW_FB_FORMAT_* */
+  uint64_t *sequence;    /* frames presented so far, host-owned */
+  /* Damage tracking (`-gpu fb-damage`), zero/null when disabled. */
+  uint32_t  tile_size;   /* tiles are tile_size x tile_size pixels */
+  uint32_t  tiles_x;     /* tiles per row, the bitmap is row-major */
+  uint64_t *damage;      /* one bit per tile, host-owned */
+} tinyw_framebuffer;
+
+/* What changed since the last delivery, sent to the GPU's `send_damage` 
+ * once a frame was presented. Rectangles are tile-aligned (clipped to the 
+ * framebuffer) and do not overlap; the pixels of rectangle `i` start at 
+ * `pixels + rects[i].offset`, as `height` rows of `width` pixels with no 
+ * padding. Everything is only valid during the call. */
+typedef struct tinyw_fb_rect {
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+  uint64_t offset;
+} tinyw_fb_rect;
+
+typedef struct tinyw_fb_damage_list {
+  uint64_t sequence;     /* latest frame presented */
+  uint32_t count;
+  uint32_t bytes_per_pixel;
+  const tinyw_fb_rect *rects;
+  const uint8_t *pixels;
+  uint64_t pixel_bytes;
+} tinyw_fb_damage_list;
+
+typedef void(*Tfunc_GPUSendDamage)(const tinyw_fb_damage_list*);
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline void tinyw_fb_present(const tinyw_framebuffer *fb) { 
+  _InterlockedExchangeAdd64((volatile long long*)fb->sequence, 1); 
+}
+static inline uint64_t tinyw_fb_sequence(const tinyw_framebuffer *fb) { 
+  return (uint64_t)_InterlockedCompareExchange64((volatile long long*)fb->sequence, 0, 0); 
+}
+#else
+static inline void tinyw_fb_present(const tinyw_framebuffer *fb) { 
+  __atomic_fetch_add(fb->sequence, 1, __ATOMIC_RELEASE); 
+}
+static inline uint64_t tinyw_fb_sequence(const tinyw_framebuffer *fb) { 
+  return __atomic_load_n(fb->sequence, __ATOMIC_ACQUIRE); 
+}
+#endif
+
+/* Marks pixels [x, x + w) x [y, y + h) as changed. Call it after writing 
+ * them and before `tinyw_fb_present`; a no-op when damage tracking is off. 
+ * CPUs that never call it still work: the host then finds changed tiles by 
+ * comparing the framebuffer against its last delivered copy. */
+static inline void tinyw_fb_damage(const tinyw_framebuffer *fb, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+  if (!fb->damage || !w || !h || x >= fb->width || y >= fb->height) return;
+  uint32_t x1 = (w > fb->width - x ? fb->width : x + w) - 1;
+  uint32_t y1 = (h > fb->height - y ? fb->height : y + h) - 1;
+  for (uint32_t ty = y / fb->tile_size; ty <= y1 / fb->tile_size; ty++) {
+    for (uint32_t tx = x / fb->tile_size; tx <= x1 / fb->tile_size; tx++) {
+      uint64_t tile = (uint64_t)ty * fb->tiles_x + tx;
+#if defined(_MSC_VER)
+      _InterlockedOr64((volatile long long*)&fb->damage[tile / 64], (long long)(1ull << (tile % 64)));
+#else
+      __atomic_fetch_or(&fb->damage[tile / 64], (uint64_t)1 << (tile % 64), __ATOMIC_RELEASE);
+#endif
+    }
+  }
+}
+
+static inline int32_t tinyw_gpu_push(const tinyw_gpu_queue *queue, const uint8_t *bytes, uint64_t len) {
+  return queue->push(queue->ctx, bytes, len);
+}
 
 #define err(x) therr(func, x)
 
@@ -44,26 +327,184 @@ extern "C" {
 #define TINYW_EXPORT extern "C" __attribute__((visibility("default")))
 #endif
 
+/* Static modules: compiled with `-DTINYW_STATIC_MODULE=<name>` and linked 
+ * into the tinyw executable, a module registers its entry points with the 
+ * host instead of exporting them, and is opened as `builtin:<name>`. A 
+ * `-cpu/-gpu/-mem file` whose name (without directory, `lib` prefix or 
+ * extension) is a static module also picks it over the library on disk. 
+ * One module per translation unit; keep its other globals `static`. 
+ * Built with the host as one LTO unit, e.g. 
+ *   g++ -std=c++20 -O2 -flto -DTINYW_STATIC_MODULE=mycpu -c mycpu.cpp 
+ *   g++ -std=c++20 -O2 -flto tinyw.cpp mycpu.o -o tinyw -ldl -lpthread 
+ * the entry points become ordinary internal functions the optimizer sees 
+ * through, instead of `dlsym`ed symbols behind the PLT. */
+#define TINYW_STR_(x) #x
+#define TINYW_STR(x) TINYW_STR_(x)
+#define TINYW_CAT_(a, b) a##b
+#define TINYW_CAT(a, b) TINYW_CAT_(a, b)
+
+#if defined(TINYW_STATIC_MODULE)
+extern "C" int tinyw_static_symbol(const char *module, const char *symbol, void *address);
+#define TINYW_ENTRY(RET, NAME, PARAMS) \
+    static RET NAME PARAMS; \
+    static const int TINYW_CAT(tinyw_static_, NAME) = \
+      tinyw_static_symbol(TINYW_STR(TINYW_STATIC_MODULE), #NAME, (void*)&NAME); \
+    static RET NAME PARAMS
+#else
+#define TINYW_ENTRY(RET, NAME, PARAMS) TINYW_EXPORT RET NAME PARAMS
+#endif
+
 #define TINYW_CPU_MODULE(START_FN, INIT_FN, STOP_FN) \
-    TINYW_EXPORT void start() { START_FN(); } \
-    TINYW_EXPORT void stop()  { STOP_FN();  } \
-    TINYW_EXPORT void init( \
+    TINYW_ENTRY(void, start, ()) { START_FN(); } \
+    TINYW_ENTRY(void, stop, ())  { STOP_FN();  } \
+    TINYW_ENTRY(void, init, ( \
         uint8_t* (*get_pointer)(), \
         uint64_t (*get_size)(), \
         uint64_t argc, char *const argv[] \
-    ) { INIT_FN(get_pointer, get_size, argc, argv); }
+    )) { INIT_FN(get_pointer, get_size, argc, argv); }
+
+/* v2 CPU: receives the region table of the memory module instead of the 
+ * v1 accessors. The table is valid until the memory module is cleared. */
+#define TINYW_CPU_MODULE_V2(START_FN, INIT_FN, STOP_FN) \
+    TINYW_ENTRY(void, start, ()) { START_FN(); } \
+    TINYW_ENTRY(void, stop, ())  { STOP_FN();  } \
+    TINYW_ENTRY(void, init_v2, ( \
+        const tinyw_mem_map* memory, \
+        uint64_t argc, char *const argv[] \
+    )) { INIT_FN(memory, argc, argv); }
+
+/* Optional: called before `init` with the host command queue to the GPU. */
+#define TINYW_CPU_GPU_QUEUE(ATTACH_FN) \
+    TINYW_ENTRY(void, attach_gpu_queue, (const tinyw_gpu_queue* queue)) { ATTACH_FN(queue); }
+
+/* Optional, CPU side: the framebuffer to draw into (`-gpu fb ...`). */
+#define TINYW_CPU_FRAMEBUFFER(ATTACH_FN) \
+    TINYW_ENTRY(void, attach_framebuffer, (const tinyw_framebuffer* fb)) { ATTACH_FN(fb); }
+
+/* Optional: SMP entry points, used instead of `start`/`stop` with `-cpu count N`, N > 1. */
+#define TINYW_CPU_SMP(START_CORE_FN, STOP_CORE_FN, ATTACH_FN) \
+    TINYW_ENTRY(void, start_core, (uint32_t core_id)) { START_CORE_FN(core_id); } \
+    TINYW_ENTRY(void, stop_core, (uint32_t core_id))  { STOP_CORE_FN(core_id);  } \
+    TINYW_ENTRY(void, attach_smp, (const tinyw_smp* smp)) { ATTACH_FN(smp); }
+
+/* Optional: lockstep entry point of the CPU; returning TINYW_STEP_HALTED ends the run. */
+#define TINYW_CPU_STEP(STEP_FN) \
+    TINYW_ENTRY(uint64_t, step, (uint64_t budget)) { return STEP_FN(budget); }
 
 #define TINYW_GPU_MODULE(START_FN, STOP_FN, SEND_BYTES_FN, INIT_FN) \
-    TINYW_EXPORT void start() { START_FN(); } \
-    TINYW_EXPORT void stop()  { STOP_FN();  } \
-    TINYW_EXPORT void send_bytes(uint8_t* bytes, uint64_t len) { SEND_BYTES_FN(bytes, len); } \
-    TINYW_EXPORT void init(uint64_t argc, char *const argv[]) { INIT_FN(argc, argv); }
+    TINYW_ENTRY(void, start, ()) { START_FN(); } \
+    TINYW_ENTRY(void, stop, ())  { STOP_FN();  } \
+    TINYW_ENTRY(void, send_bytes, (uint8_t* bytes, uint64_t len)) { SEND_BYTES_FN(bytes, len); } \
+    TINYW_ENTRY(void, init, (uint64_t argc, char *const argv[])) { INIT_FN(argc, argv); }
+
+/* Optional, GPU side: called before `init` with the framebuffer to scan out. 
+ * `send_bytes` stays available for small command traffic. */
+#define TINYW_GPU_FRAMEBUFFER(ATTACH_FN) \
+    TINYW_ENTRY(void, attach_framebuffer, (const tinyw_framebuffer* fb)) { ATTACH_FN(fb); }
+
+/* Optional, GPU side, required by `-gpu fb-damage`: receives the changed 
+ * rectangles of each presented frame instead of rescanning all of it. 
+ * Called from a host thread, concurrently with `send_bytes`. */
+#define TINYW_GPU_DAMAGE(SEND_DAMAGE_FN) \
+    TINYW_ENTRY(void, send_damage, (const tinyw_fb_damage_list* damage)) { SEND_DAMAGE_FN(damage); }
+
+/* Optional: lockstep entry point of the GPU, called after each CPU step 
+ * once the commands that step queued were delivered. */
+#define TINYW_GPU_STEP(STEP_FN) \
+    TINYW_ENTRY(uint64_t, step, (uint64_t budget)) { return STEP_FN(budget); }
 
 #define TINYW_MEMORY_MODULE(GET_POINTER_FN, GET_SIZE_FN, CLEAR_FN, INIT_FN) \
-    TINYW_EXPORT uint8_t* get_pointer() { return GET_POINTER_FN(); } \
-    TINYW_EXPORT uint64_t get_size()    { return GET_SIZE_FN();    } \
-    TINYW_EXPORT void clear()           { CLEAR_FN();              } \
-    TINYW_EXPORT void init(uint64_t argc, char *const argv[]) { INIT_FN(argc, argv); }
+    TINYW_ENTRY(uint8_t*, get_pointer, ()) { return GET_POINTER_FN(); } \
+    TINYW_ENTRY(uint64_t, get_size, ())    { return GET_SIZE_FN();    } \
+    TINYW_ENTRY(void, clear, ())           { CLEAR_FN();              } \
+    TINYW_ENTRY(void, init, (uint64_t argc, char *const argv[])) { INIT_FN(argc, argv); }
+
+/* v2 memory: publishes its region table once `init` returned. The v1 
+ * `get_pointer`/`get_size` pair is derived from the first region, so v1 CPU 
+ * modules keep working unchanged. */
+#define TINYW_MEMORY_MODULE_V2(GET_MAP_FN, CLEAR_FN, INIT_FN) \
+    TINYW_ENTRY(const tinyw_mem_map*, get_memory_map, ()) { return GET_MAP_FN(); } \
+    TINYW_ENTRY(uint8_t*, get_pointer, ()) { \
+      const tinyw_mem_map* map = GET_MAP_FN(); \
+      return map && map->count ? map->regions[0].base : 0; \
+    } \
+    TINYW_ENTRY(uint64_t, get_size, ()) { \
+      const tinyw_mem_map* map = GET_MAP_FN(); \
+      return map && map->count ? map->regions[0].size : 0; \
+    } \
+    TINYW_ENTRY(void, clear, ())           { CLEAR_FN();              } \
+    TINYW_ENTRY(void, init, (uint64_t argc, char *const argv[])) { INIT_FN(argc, argv); }
+
+/* Optional: receives the `-file` program image, mapped copy-on-write by the 
+ * host. `image` stays valid until `clear()` returns; writes never reach the 
+ * file. `offset` is the guest address requested with `-core image-offset`. */
+#define TINYW_MEMORY_LOAD_IMAGE(LOAD_IMAGE_FN) \
+    TINYW_ENTRY(void, load_image, (uint8_t* image, uint64_t len, uint64_t offset)) { LOAD_IMAGE_FN(image, len, offset); }
+
+/* Optional: guest RAM allocated by the host (`-mem size`, `-mem hugepages`). 
+ * Called before `init`; the module must use `ram` instead of allocating its 
+ * own, and must not free it. `page_size` is the backing page size in use. */
+#define TINYW_MEMORY_HOST_BACKED(ATTACH_FN) \
+    TINYW_ENTRY(void, attach_memory, (uint8_t* ram, uint64_t size, uint32_t page_size)) { ATTACH_FN(ram, size, page_size); }
+
+/* Optional, any module kind: called before `init` with the stop token. */
+#define TINYW_STOP_TOKEN(ATTACH_FN) \
+    TINYW_ENTRY(void, attach_stop_token, (const tinyw_stop_token* token)) { ATTACH_FN(token); }
+
+/* Optional, any module kind: called before `init` with the host services. */
+#define TINYW_HOST_SERVICES(ATTACH_FN) \
+    TINYW_ENTRY(void, attach_host, (const tinyw_host_services* host)) { ATTACH_FN(host); }
+
+/* Optional, any module kind: called before `init` with the host tracer. */
+#define TINYW_TRACER(ATTACH_FN) \
+    TINYW_ENTRY(void, attach_tracer, (const tinyw_tracer* tracer)) { ATTACH_FN(tracer); }
+
+#define TINYW_INSTANCE(CREATE_FN, DESTROY_FN) \
+    TINYW_ENTRY(tinyw_instance, create_instance, ()) { return CREATE_FN(); } \
+    TINYW_ENTRY(void, destroy_instance, (tinyw_instance self)) { DESTROY_FN(self); }
+
+/* Optional, any instance module: `resource` is one of TINYW_ATTACH_*. */
+#define TINYW_INSTANCE_ATTACH(ATTACH_FN) \
+    TINYW_ENTRY(int32_t, attach_i, (tinyw_instance self, uint32_t kind, const void* resource)) { return ATTACH_FN(self, kind, resource); }
+
+/* Instance CPUs always receive the region table, as in v2. */
+#define TINYW_CPU_INSTANCE_MODULE(START_FN, INIT_FN, STOP_FN) \
+    TINYW_ENTRY(void, start_i, (tinyw_instance self)) { START_FN(self); } \
+    TINYW_ENTRY(void, stop_i, (tinyw_instance self))  { STOP_FN(self);  } \
+    TINYW_ENTRY(void, init_i, ( \
+        tinyw_instance self, \
+        const tinyw_mem_map* memory, \
+        uint64_t argc, char *const argv[] \
+    )) { INIT_FN(self, memory, argc, argv); }
+
+#define TINYW_CPU_INSTANCE_SMP(START_CORE_FN, STOP_CORE_FN) \
+    TINYW_ENTRY(void, start_core_i, (tinyw_instance self, uint32_t core_id)) { START_CORE_FN(self, core_id); } \
+    TINYW_ENTRY(void, stop_core_i, (tinyw_instance self, uint32_t core_id))  { STOP_CORE_FN(self, core_id);  }
+
+#define TINYW_INSTANCE_STEP(STEP_FN) \
+    TINYW_ENTRY(uint64_t, step_i, (tinyw_instance self, uint64_t budget)) { return STEP_FN(self, budget); }
+
+#define TINYW_GPU_INSTANCE_MODULE(START_FN, STOP_FN, SEND_BYTES_FN, INIT_FN) \
+    TINYW_ENTRY(void, start_i, (tinyw_instance self)) { START_FN(self); } \
+    TINYW_ENTRY(void, stop_i, (tinyw_instance self))  { STOP_FN(self);  } \
+    TINYW_ENTRY(void, send_bytes_i, (tinyw_instance self, uint8_t* bytes, uint64_t len)) { SEND_BYTES_FN(self, bytes, len); } \
+    TINYW_ENTRY(void, init_i, (tinyw_instance self, uint64_t argc, char *const argv[])) { INIT_FN(self, argc, argv); }
+
+#define TINYW_GPU_INSTANCE_DAMAGE(SEND_DAMAGE_FN) \
+    TINYW_ENTRY(void, send_damage_i, (tinyw_instance self, const tinyw_fb_damage_list* damage)) { SEND_DAMAGE_FN(self, damage); }
+
+/* Instance memories only publish a region table, so they pair with v2 or 
+ * instance CPUs. */
+#define TINYW_MEMORY_INSTANCE_MODULE(GET_MAP_FN, CLEAR_FN, INIT_FN) \
+    TINYW_ENTRY(const tinyw_mem_map*, get_memory_map_i, (tinyw_instance self)) { return GET_MAP_FN(self); } \
+    TINYW_ENTRY(void, clear_i, (tinyw_instance self)) { CLEAR_FN(self); } \
+    TINYW_ENTRY(void, init_i, (tinyw_instance self, uint64_t argc, char *const argv[])) { INIT_FN(self, argc, argv); }
+
+#define TINYW_MEMORY_INSTANCE_LOAD_IMAGE(LOAD_IMAGE_FN) \
+    TINYW_ENTRY(void, load_image_i, (tinyw_instance self, uint8_t* image, uint64_t len, uint64_t offset)) { LOAD_IMAGE_FN(self, image, len, offset); }
+
+#define TINYW_MEMORY_INSTANCE_HOST_BACKED(ATTACH_FN) \
+    TINYW_ENTRY(void, attach_memory_i, (tinyw_instance self, uint8_t* ram, uint64_t size, uint32_t page_size)) { ATTACH_FN(self, ram, size, page_size); }
 
 #ifdef __cplusplus
 }
@@ -100,14 +541,241 @@ inline void therr(const std::string &from, const std::string &what) {
 #endif // C++
 #endif // def?)";
 
+inline constexpr std::string_view BytesOf_File_mem_view_hpp = R"(#pragma once
+
+/* Typed guest memory accesses for CPU modules (C++20), installed next to
+ * tinyc.h. A `mem_view` wraps one host window of guest memory (a region
+ * of the v2 map, or the v1 `get_pointer`/`get_size` pair) and everything
+ * about an access is fixed by its type, so each load or store compiles
+ * to one move, plus a byte swap when the guest's byte order differs from
+ * the host's, plus the bounds policy:
+ *
+ *   checked    out-of-range (or, if aligned, misaligned) accesses read 0
+ *              and write nothing; the first one is remembered in
+ *              `fault_address()` for the interpreter to raise
+ *   masked     addresses wrap around the window, which is then rounded
+ *              down to a power of two; an access that would run past its
+ *              end is clamped to end there (unaligned) or rounded down to
+ *              its natural alignment (aligned), so it is always one move
+ *              inside the window. Never faults. An empty view (or one
+ *              over less than 8 bytes) reads 0 and drops stores
+ *   unchecked  the caller guarantees the access is inside the window
+ *
+ * `alignment::aligned` promises the compiler that accesses are naturally
+ * aligned (and makes checked views reject the others).
+ *
+ *   tinyw::mem_view<std::endian::big> ram(map->regions[0]);
+ *   uint32_t insn = ram.load<uint32_t>(pc);
+ *   if (ram.faulted()) raise_bus_error(ram.fault_address());
+ *
+ * Not thread-safe for guest atomics: SMP modules keep using `tinyw_atomics`. */
+
+#include <bit>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(_MSC_VER)
+  #include <stdlib.h>
+#endif
+
+namespace tinyw {
+
+enum class bounds { checked, masked, unchecked };
+enum class alignment { aligned, unaligned };
+
+namespace detail {
+
+template <size_t N> struct uint_of;
+template <> struct uint_of<1> { typedef uint8_t type; };
+template <> struct uint_of<2> { typedef uint16_t type; };
+template <> struct uint_of<4> { typedef uint32_t type; };
+template <> struct uint_of<8> { typedef uint64_t type; };
+
+template <typename U>
+inline U byte_swap(U value) {
+  if constexpr (sizeof(U) == 1) return value;
+#if defined(_MSC_VER)
+  else if constexpr (sizeof(U) == 2) return _byteswap_ushort(value);
+  else if constexpr (sizeof(U) == 4) return _byteswap_ulong(value);
+  else return _byteswap_uint64(value);
+#else
+  else if constexpr (sizeof(U) == 2) return __builtin_bswap16(value);
+  else if constexpr (sizeof(U) == 4) return __builtin_bswap32(value);
+  else return __builtin_bswap64(value);
+#endif
+}
+
+} // namespace detail
+
+template <std::endian Endian = std::endian::little,
+          bounds Bounds = bounds::checked,
+          alignment Align = alignment::unaligned>
+class mem_view {
+private:
+  uint8_t *base_ = nullptr;
+  uint64_t guest_ = 0;         // guest address of base_[0]
+  uint64_t size_ = 0;
+  mutable bool faulted_ = false;
+  mutable uint64_t fault_ = 0;
+
+  void fault(uint64_t addr) const {
+    if (!faulted_) faulted_ = true, fault_ = addr;
+  }
+
+  // Host address of a `width`-byte access, null if a checked view refused it.
+  template <size_t Width>
+  uint8_t *at(uint64_t addr) const {
+    uint64_t offset = addr - guest_;
+    if constexpr (Bounds == bounds::checked) {
+      if (offset >= size_ || size_ - offset < Width || (Align == alignment::aligned && offset % Width)) [[unlikely]] {
+        fault(addr);
+        return nullptr;
+      }
+    } else if constexpr (Bounds == bounds::masked) {
+      if (size_ == 0) [[unlikely]] return empty_slot();
+      offset &= size_ - 1;
+      if constexpr (Align == alignment::aligned) offset &= ~uint64_t(Width - 1);
+      else if constexpr (Width > 1) offset = std::min<uint64_t>(offset, size_ - Width);
+    }
+    return base_ + offset;
+  }
+
+  // Where the accesses of an empty masked view go: cleared for every one.
+  static uint8_t *empty_slot() {
+    alignas(8) static thread_local uint8_t slot[8];
+    std::memset(slot, 0, sizeof slot);
+    return slot;
+  }
+
+public:
+  static constexpr std::endian byte_order = Endian;
+  static constexpr bounds bounds_policy = Bounds;
+  static constexpr alignment alignment_policy = Align;
+
+  mem_view() = default;
+
+  mem_view(uint8_t *base, uint64_t size, uint64_t guest_addr = 0)
+    : base_(base), guest_(guest_addr), size_(size) {
+    if constexpr (Bounds == bounds::masked) size_ = size_ >= 8 ? std::bit_floor(size_) : 0;
+    if (!base_) size_ = 0;
+  }
+
+  // Any region-like struct, e.g. `tinyw_mem_region`.
+  template <typename Region>
+  explicit mem_view(const Region &region) : mem_view(region.base, region.size, region.guest_addr) {}
+
+  template <typename T>
+  T load(uint64_t addr) const {
+    static_assert(std::is_trivially_copyable_v<T> && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8),
+                  "mem_view accesses are 1, 2, 4 or 8 bytes wide");
+    typedef typename detail::uint_of<sizeof(T)>::type U;
+    const uint8_t *p = at<sizeof(T)>(addr);
+    if constexpr (Bounds == bounds::checked) if (!p) [[unlikely]] return T{};
+
+    U raw;
+    if constexpr (Align == alignment::aligned) std::memcpy(&raw, std::assume_aligned<sizeof(T)>(p), sizeof(T));
+    else std::memcpy(&raw, p, sizeof(T));
+    if constexpr (Endian != std::endian::native) raw = detail::byte_swap(raw);
+    return std::bit_cast<T>(raw);
+  }
+
+  template <typename T>
+  void store(uint64_t addr, T value) const {
+    static_assert(std::is_trivially_copyable_v<T> && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8),
+                  "mem_view accesses are 1, 2, 4 or 8 bytes wide");
+    typedef typename detail::uint_of<sizeof(T)>::type U;
+    uint8_t *p = at<sizeof(T)>(addr);
+    if constexpr (Bounds == bounds::checked) if (!p) [[unlikely]] return;
+
+    U raw = std::bit_cast<U>(value);
+    if constexpr (Endian != std::endian::native) raw = detail::byte_swap(raw);
+    if constexpr (Align == alignment::aligned) std::memcpy(std::assume_aligned<sizeof(T)>(p), &raw, sizeof(T));
+    else std::memcpy(p, &raw, sizeof(T));
+  }
+
+  uint8_t  u8(uint64_t addr) const  { return load<uint8_t>(addr); }
+  uint16_t u16(uint64_t addr) const { return load<uint16_t>(addr); }
+  uint32_t u32(uint64_t addr) const { return load<uint32_t>(addr); }
+  uint64_t u64(uint64_t addr) const { return load<uint64_t>(addr); }
+
+  // Block copies, byte order untouched. Checked views copy nothing and
+  // return false when any byte is out of range; masked ones wrap.
+  bool read(uint64_t addr, void *dst, uint64_t len) const { return copy(addr, static_cast<uint8_t*>(dst), len, false); }
+  bool write(uint64_t addr, const void *src, uint64_t len) const {
+    return copy(addr, static_cast<uint8_t*>(const_cast<void*>(src)), len, true);
+  }
+
+  bool contains(uint64_t addr, uint64_t len = 1) const {
+    uint64_t offset = addr - guest_;
+    return offset < size_ && size_ - offset >= len;
+  }
+
+  uint8_t *data() const { return base_; }
+  uint64_t size() const { return size_; }
+  uint64_t guest_addr() const { return guest_; }
+
+  // Checked views: whether an access was refused since the last
+  // `clear_fault`, and the guest address of the first one.
+  bool faulted() const { return faulted_; }
+  uint64_t fault_address() const { return fault_; }
+  void clear_fault() const { faulted_ = false; fault_ = 0; }
+
+private:
+  bool copy(uint64_t addr, uint8_t *host, uint64_t len, bool to_guest) const {
+    if (len == 0) return true;
+    if constexpr (Bounds == bounds::masked) {
+      if (size_ == 0) return false;
+      while (len) {
+        uint64_t offset = (addr - guest_) & (size_ - 1), n = std::min(len, size_ - offset);
+        if (to_guest) std::memmove(base_ + offset, host, n);
+        else std::memmove(host, base_ + offset, n);
+        addr += n, host += n, len -= n;
+      }
+      return true;
+    } else {
+      if constexpr (Bounds == bounds::checked) {
+        if (!contains(addr, len)) { fault(addr); return false; }
+      }
+      uint8_t *p = base_ + (addr - guest_);
+      if (to_guest) std::memmove(p, host, len);
+      else std::memmove(host, p, len);
+      return true;
+    }
+  }
+};
+
+template <bounds Bounds = bounds::checked, alignment Align = alignment::unaligned>
+using le_view = mem_view<std::endian::little, Bounds, Align>;
+
+template <bounds Bounds = bounds::checked, alignment Align = alignment::unaligned>
+using be_view = mem_view<std::endian::big, Bounds, Align>;
+
+} // namespace tinyw
+)";
+
+struct BuiltInFile {
+  fs::path name;
+  std::string_view bytes;
+};
+
+// Files installed under ~/.tinyw/include/tinyw/.
+inline std::vector<BuiltInFile> built_in_files() {
+  return {
+    {"tinyc.h", BytesOf_File_tinyc_h},
+    {"mem_view.hpp", BytesOf_File_mem_view_hpp},
+  };
+}
+
 inline GenericTask copy_built_in_files(const fs::path &prefix) {
-  return GenericTask("copying built-in files", [&](auto report_progress){
-    std::ofstream file(prefix / "tinyc.h");
-    for (size_t i = 0; i < sizeof(BytesOf_File_tinyc_h); i++) {
-      file.put(BytesOf_File_tinyc_h[i]);
-      report_progress((float)i / sizeof(BytesOf_File_tinyc_h));
+  return GenericTask("copying built-in files", [prefix](auto report_progress){
+    auto files = built_in_files();
+    for (size_t i = 0; i < files.size(); i++) {
+      write_file_atomic(prefix / files[i].name, files[i].bytes.data(), files[i].bytes.size());
+      report_progress((float)(i + 1) / files.size());
     }
-    file.close();
   });
 
 }
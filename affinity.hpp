@@ -0,0 +1,164 @@
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+
+#if defined(__linux__)
+  #include <sched.h>
+  #include <pthread.h>
+  #include <unistd.h>
+  #include <sys/syscall.h>
+  #include <sys/resource.h>
+#endif
+
+#include "glob.hpp"
+
+TinyWDeclStart
+
+// Where and how a VM thread runs. Options left empty are not touched.
+struct ThreadPlacement {
+  std::vector<int> cpus;      // allowed host CPUs
+  int policy = -1;            // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+  int priority = 0;           // real-time priority for FIFO/RR
+  bool has_nice = false;
+  int nice = 0;
+
+  bool Empty() const { return cpus.empty() && policy < 0 && !has_nice; }
+};
+
+// "0-3,8,10-11" -> {0, 1, 2, 3, 8, 10, 11}
+inline std::vector<int> parse_cpu_list(const std::string &list) {
+  std::set<int> cpus;
+  std::stringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (item.empty()) continue;
+    auto dash = item.find('-');
+    int first = std::stoi(item.substr(0, dash));
+    int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+    if (first < 0 || last < first) therr(func, "Invalid CPU range: `" + item + "`");
+    for (int cpu = first; cpu <= last; cpu++) cpus.insert(cpu);
+  }
+  return std::vector<int>(cpus.begin(), cpus.end());
+}
+
+inline std::string format_cpu_list(const std::vector<int> &cpus) {
+  std::string out;
+  for (size_t i = 0; i < cpus.size(); i++) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) j++;
+    if (!out.empty()) out += ",";
+    out += std::to_string(cpus[i]);
+    if (j > i) out += "-" + std::to_string(cpus[j]);
+    i = j;
+  }
+  return out.empty() ? "none" : out;
+}
+
+// "other", "fifo:<prio>", "rr:<prio>"
+inline void parse_sched_policy(const std::string &value, ThreadPlacement &placement) {
+  auto v = to_lowercase(value);
+  auto colon = v.find(':');
+  auto name = v.substr(0, colon);
+  placement.priority = colon == std::string::npos ? 1 : std::stoi(v.substr(colon + 1));
+#if defined(__linux__)
+  if (name == "other") placement.policy = SCHED_OTHER, placement.priority = 0;
+  else if (name == "fifo") placement.policy = SCHED_FIFO;
+  else if (name == "rr") placement.policy = SCHED_RR;
+  else therr(func, "Unknown scheduling policy: `" + value + "` (expected other, fifo:<prio> or rr:<prio>)");
+#else
+  if (name != "other" && name != "fifo" && name != "rr") therr(func, "Unknown scheduling policy: `" + value + "`");
+  placement.policy = 0;
+#endif
+}
+
+// Applies `placement` to the calling thread and describes what actually
+// took effect; failures (e.g. SCHED_FIFO without CAP_SYS_NICE) are reported,
+// not fatal.
+inline std::string apply_thread_placement(const ThreadPlacement &placement) {
+  std::string report;
+  auto add = [&](const std::string &part) { report += (report.empty() ? "" : ", ") + part; };
+
+#if defined(__linux__)
+  if (!placement.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : placement.cpus) if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) add("affinity failed (" + std::string(strerror(err)) + ")");
+  }
+
+  cpu_set_t current;
+  if (pthread_getaffinity_np(pthread_self(), sizeof(current), &current) == 0) {
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) if (CPU_ISSET(cpu, &current)) cpus.push_back(cpu);
+    add("cpus " + format_cpu_list(cpus));
+  }
+
+  if (placement.policy >= 0) {
+    sched_param param{};
+    param.sched_priority = placement.priority;
+    int err = pthread_setschedparam(pthread_self(), placement.policy, &param);
+    if (err) add("sched failed (" + std::string(strerror(err)) + ")");
+  }
+
+  int policy = 0;
+  sched_param param{};
+  if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+    if (policy == SCHED_FIFO) add("SCHED_FIFO " + std::to_string(param.sched_priority));
+    else if (policy == SCHED_RR) add("SCHED_RR " + std::to_string(param.sched_priority));
+    else add("SCHED_OTHER");
+  }
+
+  // On Linux the nice value is per thread, addressed by its tid.
+  const id_t tid = (id_t)syscall(SYS_gettid);
+  if (placement.has_nice && setpriority(PRIO_PROCESS, tid, placement.nice) != 0)
+    add("nice failed (" + std::string(strerror(errno)) + ")");
+  errno = 0;
+  int nice = getpriority(PRIO_PROCESS, tid);
+  if (errno == 0) add("nice " + std::to_string(nice));
+#else
+  if (!placement.Empty()) add("placement not supported on this host");
+#endif
+
+  return report;
+}
+
+// NUMA node of a host CPU, or -1 when unknown (no NUMA, not Linux).
+inline int numa_node_of_cpu(int cpu) {
+#if defined(__linux__)
+  std::error_code ec;
+  auto dir = fs::path("/sys/devices/system/cpu") / ("cpu" + std::to_string(cpu));
+  for (const auto &entry : fs::directory_iterator(dir, ec)) {
+    auto name = entry.path().filename().string();
+    if (name.rfind("node", 0) == 0 && name.size() > 4) return std::stoi(name.substr(4));
+  }
+#endif
+  return -1;
+}
+
+// Binds [data, data + size) to `node` with mbind(2), moving pages that
+// were already touched. Returns an empty string or the error.
+inline std::string bind_memory_to_node(void *data, uint64_t size, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  constexpr int MPolBind = 2;         // MPOL_BIND
+  constexpr unsigned MPolMoveFlag = 2; // MPOL_MF_MOVE
+  const unsigned long bits = sizeof(unsigned long) * 8;
+  std::vector<unsigned long> mask(node / bits + 1, 0);
+  mask[node / bits] |= 1ul << (node % bits);
+  if (syscall(SYS_mbind, data, size, MPolBind, mask.data(), mask.size() * bits + 1, MPolMoveFlag) != 0)
+    return strerror(errno);
+  return "";
+#else
+  return "mbind not supported on this host";
+#endif
+}
+
+TinyWDeclEnd
@@ -0,0 +1,213 @@
+#pragma once
+
+/* Typed guest memory accesses for CPU modules (C++20), installed next to
+ * tinyc.h. A `mem_view` wraps one host window of guest memory (a region
+ * of the v2 map, or the v1 `get_pointer`/`get_size` pair) and everything
+ * about an access is fixed by its type, so each load or store compiles
+ * to one move, plus a byte swap when the guest's byte order differs from
+ * the host's, plus the bounds policy:
+ *
+ *   checked    out-of-range (or, if aligned, misaligned) accesses read 0
+ *              and write nothing; the first one is remembered in
+ *              `fault_address()` for the interpreter to raise
+ *   masked     addresses wrap around the window, which is then rounded
+ *              down to a power of two; an access that would run past its
+ *              end is clamped to end there (unaligned) or rounded down to
+ *              its natural alignment (aligned), so it is always one move
+ *              inside the window. Never faults. An empty view (or one
+ *              over less than 8 bytes) reads 0 and drops stores
+ *   unchecked  the caller guarantees the access is inside the window
+ *
+ * `alignment::aligned` promises the compiler that accesses are naturally
+ * aligned (and makes checked views reject the others).
+ *
+ *   tinyw::mem_view<std::endian::big> ram(map->regions[0]);
+ *   uint32_t insn = ram.load<uint32_t>(pc);
+ *   if (ram.faulted()) raise_bus_error(ram.fault_address());
+ *
+ * Not thread-safe for guest atomics: SMP modules keep using `tinyw_atomics`. */
+
+#include <bit>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(_MSC_VER)
+  #include <stdlib.h>
+#endif
+
+namespace tinyw {
+
+enum class bounds { checked, masked, unchecked };
+enum class alignment { aligned, unaligned };
+
+namespace detail {
+
+template <size_t N> struct uint_of;
+template <> struct uint_of<1> { typedef uint8_t type; };
+template <> struct uint_of<2> { typedef uint16_t type; };
+template <> struct uint_of<4> { typedef uint32_t type; };
+template <> struct uint_of<8> { typedef uint64_t type; };
+
+template <typename U>
+inline U byte_swap(U value) {
+  if constexpr (sizeof(U) == 1) return value;
+#if defined(_MSC_VER)
+  else if constexpr (sizeof(U) == 2) return _byteswap_ushort(value);
+  else if constexpr (sizeof(U) == 4) return _byteswap_ulong(value);
+  else return _byteswap_uint64(value);
+#else
+  else if constexpr (sizeof(U) == 2) return __builtin_bswap16(value);
+  else if constexpr (sizeof(U) == 4) return __builtin_bswap32(value);
+  else return __builtin_bswap64(value);
+#endif
+}
+
+} // namespace detail
+
+template <std::endian Endian = std::endian::little,
+          bounds Bounds = bounds::checked,
+          alignment Align = alignment::unaligned>
+class mem_view {
+private:
+  uint8_t *base_ = nullptr;
+  uint64_t guest_ = 0;         // guest address of base_[0]
+  uint64_t size_ = 0;
+  mutable bool faulted_ = false;
+  mutable uint64_t fault_ = 0;
+
+  void fault(uint64_t addr) const {
+    if (!faulted_) faulted_ = true, fault_ = addr;
+  }
+
+  // Host address of a `width`-byte access, null if a checked view refused it.
+  template <size_t Width>
+  uint8_t *at(uint64_t addr) const {
+    uint64_t offset = addr - guest_;
+    if constexpr (Bounds == bounds::checked) {
+      if (offset >= size_ || size_ - offset < Width || (Align == alignment::aligned && offset % Width)) [[unlikely]] {
+        fault(addr);
+        return nullptr;
+      }
+    } else if constexpr (Bounds == bounds::masked) {
+      if (size_ == 0) [[unlikely]] return empty_slot();
+      offset &= size_ - 1;
+      if constexpr (Align == alignment::aligned) offset &= ~uint64_t(Width - 1);
+      else if constexpr (Width > 1) offset = std::min<uint64_t>(offset, size_ - Width);
+    }
+    return base_ + offset;
+  }
+
+  // Where the accesses of an empty masked view go: cleared for every one.
+  static uint8_t *empty_slot() {
+    alignas(8) static thread_local uint8_t slot[8];
+    std::memset(slot, 0, sizeof slot);
+    return slot;
+  }
+
+public:
+  static constexpr std::endian byte_order = Endian;
+  static constexpr bounds bounds_policy = Bounds;
+  static constexpr alignment alignment_policy = Align;
+
+  mem_view() = default;
+
+  mem_view(uint8_t *base, uint64_t size, uint64_t guest_addr = 0)
+    : base_(base), guest_(guest_addr), size_(size) {
+    if constexpr (Bounds == bounds::masked) size_ = size_ >= 8 ? std::bit_floor(size_) : 0;
+    if (!base_) size_ = 0;
+  }
+
+  // Any region-like struct, e.g. `tinyw_mem_region`.
+  template <typename Region>
+  explicit mem_view(const Region &region) : mem_view(region.base, region.size, region.guest_addr) {}
+
+  template <typename T>
+  T load(uint64_t addr) const {
+    static_assert(std::is_trivially_copyable_v<T> && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8),
+                  "mem_view accesses are 1, 2, 4 or 8 bytes wide");
+    typedef typename detail::uint_of<sizeof(T)>::type U;
+    const uint8_t *p = at<sizeof(T)>(addr);
+    if constexpr (Bounds == bounds::checked) if (!p) [[unlikely]] return T{};
+
+    U raw;
+    if constexpr (Align == alignment::aligned) std::memcpy(&raw, std::assume_aligned<sizeof(T)>(p), sizeof(T));
+    else std::memcpy(&raw, p, sizeof(T));
+    if constexpr (Endian != std::endian::native) raw = detail::byte_swap(raw);
+    return std::bit_cast<T>(raw);
+  }
+
+  template <typename T>
+  void store(uint64_t addr, T value) const {
+    static_assert(std::is_trivially_copyable_v<T> && (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8),
+                  "mem_view accesses are 1, 2, 4 or 8 bytes wide");
+    typedef typename detail::uint_of<sizeof(T)>::type U;
+    uint8_t *p = at<sizeof(T)>(addr);
+    if constexpr (Bounds == bounds::checked) if (!p) [[unlikely]] return;
+
+    U raw = std::bit_cast<U>(value);
+    if constexpr (Endian != std::endian::native) raw = detail::byte_swap(raw);
+    if constexpr (Align == alignment::aligned) std::memcpy(std::assume_aligned<sizeof(T)>(p), &raw, sizeof(T));
+    else std::memcpy(p, &raw, sizeof(T));
+  }
+
+  uint8_t  u8(uint64_t addr) const  { return load<uint8_t>(addr); }
+  uint16_t u16(uint64_t addr) const { return load<uint16_t>(addr); }
+  uint32_t u32(uint64_t addr) const { return load<uint32_t>(addr); }
+  uint64_t u64(uint64_t addr) const { return load<uint64_t>(addr); }
+
+  // Block copies, byte order untouched. Checked views copy nothing and
+  // return false when any byte is out of range; masked ones wrap.
+  bool read(uint64_t addr, void *dst, uint64_t len) const { return copy(addr, static_cast<uint8_t*>(dst), len, false); }
+  bool write(uint64_t addr, const void *src, uint64_t len) const {
+    return copy(addr, static_cast<uint8_t*>(const_cast<void*>(src)), len, true);
+  }
+
+  bool contains(uint64_t addr, uint64_t len = 1) const {
+    uint64_t offset = addr - guest_;
+    return offset < size_ && size_ - offset >= len;
+  }
+
+  uint8_t *data() const { return base_; }
+  uint64_t size() const { return size_; }
+  uint64_t guest_addr() const { return guest_; }
+
+  // Checked views: whether an access was refused since the last
+  // `clear_fault`, and the guest address of the first one.
+  bool faulted() const { return faulted_; }
+  uint64_t fault_address() const { return fault_; }
+  void clear_fault() const { faulted_ = false; fault_ = 0; }
+
+private:
+  bool copy(uint64_t addr, uint8_t *host, uint64_t len, bool to_guest) const {
+    if (len == 0) return true;
+    if constexpr (Bounds == bounds::masked) {
+      if (size_ == 0) return false;
+      while (len) {
+        uint64_t offset = (addr - guest_) & (size_ - 1), n = std::min(len, size_ - offset);
+        if (to_guest) std::memmove(base_ + offset, host, n);
+        else std::memmove(host, base_ + offset, n);
+        addr += n, host += n, len -= n;
+      }
+      return true;
+    } else {
+      if constexpr (Bounds == bounds::checked) {
+        if (!contains(addr, len)) { fault(addr); return false; }
+      }
+      uint8_t *p = base_ + (addr - guest_);
+      if (to_guest) std::memmove(p, host, len);
+      else std::memmove(host, p, len);
+      return true;
+    }
+  }
+};
+
+template <bounds Bounds = bounds::checked, alignment Align = alignment::unaligned>
+using le_view = mem_view<std::endian::little, Bounds, Align>;
+
+template <bounds Bounds = bounds::checked, alignment Align = alignment::unaligned>
+using be_view = mem_view<std::endian::big, Bounds, Align>;
+
+} // namespace tinyw
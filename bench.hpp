@@ -0,0 +1,483 @@
+#pragma once
+
+#include <map>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+
+#if !defined(_WIN32)
+  #include <unistd.h>
+#endif
+
+#include "glob.hpp"
+#include "tasks.hpp"
+#include "core.hpp"
+#include "builtin.hpp"
+#include "base/mem_view.hpp"
+
+TinyWDeclStart
+
+// `tinyw bench`: runs standard workloads on the reference modules (or on
+// modules given with -cpu/-gpu/-mem file) a number of times and reports
+// each measurement with its spread, as a table and optionally as JSON.
+class Benchmark {
+public:
+  struct Result;
+
+  // A reference CPU program and what running it must produce, or a host
+  // microbenchmark (`measure`) that runs no VM at all. Every program sends 
+  // its result to the GPU, where builtin:nullgpu sums the first word of 
+  // each record into `checksum`: this is what validates other CPU modules.
+  struct Workload {
+    std::string name;
+    std::string description;
+    std::vector<uint8_t> image;
+    uint64_t instructions = 0;
+    uint64_t sent_records = 0;
+    uint64_t sent_bytes = 0;
+    uint64_t checksum = 0;
+    bool streams = false;        // reports GPU send rates
+    uint64_t copied_bytes = 0;
+    std::function<void(Result&, bool)> measure;
+  };
+
+  struct Stat {
+    std::vector<double> samples;
+
+    double Mean() const {
+      double sum = 0;
+      for (double s : samples) sum += s;
+      return samples.empty() ? 0 : sum / samples.size();
+    }
+
+    // Sample standard deviation.
+    double StdDev() const {
+      if (samples.size() < 2) return 0;
+      double mean = Mean(), sum = 0;
+      for (double s : samples) sum += (s - mean) * (s - mean);
+      return std::sqrt(sum / (samples.size() - 1));
+    }
+
+    double Min() const { return samples.empty() ? 0 : *std::min_element(samples.begin(), samples.end()); }
+    double Max() const { return samples.empty() ? 0 : *std::max_element(samples.begin(), samples.end()); }
+
+    double Median() const {
+      if (samples.empty()) return 0;
+      auto sorted = samples;
+      std::sort(sorted.begin(), sorted.end());
+      size_t mid = sorted.size() / 2;
+      return sorted.size() % 2 ? sorted[mid] : (sorted[mid - 1] + sorted[mid]) / 2;
+    }
+  };
+
+  struct Result {
+    const Workload *workload;
+    std::vector<std::pair<std::string, Stat>> stats;   // report order
+
+    Stat &operator[](const std::string &name) {
+      for (auto &[key, stat] : stats) if (key == name) return stat;
+      stats.push_back({ name, Stat{} });
+      return stats.back().second;
+    }
+  };
+
+  // Workloads at `scale` 1 take a fraction of a second each.
+  static std::vector<Workload> StandardWorkloads(double scale) {
+    using builtin::RefOp;
+    auto count = [scale](uint64_t n) { return std::max<uint64_t>(1, (uint64_t)(n * scale)); };
+    std::vector<Workload> workloads;
+
+    // Integer ALU loop: instructions per second of the CPU module.
+    {
+      Workload w;
+      w.name = "alu";
+      w.description = "integer ALU loop, 5 instructions per iteration";
+      const uint64_t n = count(10'000'000);
+      const uint64_t k = 0x9E3779B97F4A7C15ull;
+      builtin::RefAssembler code;
+      code.Li(1, n).Li(3, k).Li(4, 0).Li(5, 0).Li(6, 0);
+      auto loop = code.Here();
+      code.Op(RefOp::Add, 4, 4, 3).Op(RefOp::Xor, 5, 5, 4).Op(RefOp::Mul, 6, 4, 5).Op(RefOp::Addi, 1, 1, 0xff).Bnz(1, loop);
+      code.Op(RefOp::Xor, 7, 5, 6).Op(RefOp::Add, 7, 7, 4).Li(8, 0x1000).Li(9, 8).Op(RefOp::St, 7, 8).Op(RefOp::Send, 8, 9);
+      code.Op(RefOp::Halt);
+      w.image = code.Code();
+      w.instructions = 5 + 5 * n + 6 + 1;
+      uint64_t r4 = 0, r5 = 0, r6 = 0;
+      for (uint64_t i = 0; i < n; i++) { r4 += k; r5 ^= r4; r6 = r4 * r5; }
+      w.sent_records = 1;
+      w.sent_bytes = 8;
+      w.checksum = (r5 ^ r6) + r4;
+      workloads.push_back(std::move(w));
+    }
+
+    // 64-byte records through the GPU queue: `send_bytes` throughput.
+    {
+      Workload w;
+      w.name = "send";
+      w.description = "64-byte records pushed to the GPU, each led by the loop counter";
+      const uint64_t n = count(500'000);
+      builtin::RefAssembler code;
+      code.Li(1, n).Li(2, 0x10000).Li(3, 64);
+      auto loop = code.Here();
+      code.Op(RefOp::St, 1, 2).Op(RefOp::Send, 2, 3).Op(RefOp::Addi, 1, 1, 0xff).Bnz(1, loop);
+      code.Op(RefOp::Halt);
+      w.image = code.Code();
+      w.instructions = 3 + 4 * n + 1;
+      w.sent_records = n;
+      w.sent_bytes = 64 * n;
+      w.checksum = n * (n + 1) / 2;
+      w.streams = true;
+      workloads.push_back(std::move(w));
+    }
+
+    // 1 MiB block copies through the memory module's region table.
+    {
+      Workload w;
+      w.name = "memcpy";
+      w.description = "1 MiB copies inside guest memory, last word checked";
+      const uint64_t n = count(1'000);
+      builtin::RefAssembler code;
+      code.Li(1, n).Li(2, 0x200000).Li(3, 0x100000).Li(4, 1 << 20).Li(6, 0);
+      code.Li(10, 0x100000 + (1 << 20) - 8).Li(11, 0x200000 + (1 << 20) - 8);
+      auto loop = code.Here();
+      code.Op(RefOp::St, 1, 10).Op(RefOp::Copy, 2, 3, 4).Op(RefOp::Ld, 5, 11).Op(RefOp::Add, 6, 6, 5);
+      code.Op(RefOp::Addi, 1, 1, 0xff).Bnz(1, loop);
+      code.Li(12, 0x1000).Li(13, 8).Op(RefOp::St, 6, 12).Op(RefOp::Send, 12, 13);
+      code.Op(RefOp::Halt);
+      w.image = code.Code();
+      w.instructions = 7 + 6 * n + 4 + 1;
+      w.sent_records = 1;
+      w.sent_bytes = 8;
+      w.checksum = n * (n + 1) / 2;
+      w.copied_bytes = n << 20;
+      workloads.push_back(std::move(w));
+    }
+
+    // base/mem_view.hpp against the byte loops CPU modules write by hand.
+    {
+      Workload w;
+      w.name = "memview";
+      w.description = "guest loads/stores: mem_view vs. a byte loop (ns per access)";
+      const uint64_t n = count(20'000'000);
+      w.measure = [n](Result &result, bool record) { MeasureMemView(n, result, record); };
+      workloads.push_back(std::move(w));
+    }
+
+    return workloads;
+  }
+
+  // Guest accesses as hand-written CPU modules do them: a byte at a time,
+  // each byte bounds-checked.
+  static uint32_t NaiveLoad32LE(const uint8_t *ram, uint64_t size, uint64_t addr, bool &fault) {
+    uint32_t value = 0;
+    for (unsigned i = 0; i < 4; i++) {
+      if (addr + i >= size) { fault = true; return 0; }
+      value |= uint32_t(ram[addr + i]) << (8 * i);
+    }
+    return value;
+  }
+
+  static uint64_t NaiveLoad64BE(const uint8_t *ram, uint64_t size, uint64_t addr, bool &fault) {
+    uint64_t value = 0;
+    for (unsigned i = 0; i < 8; i++) {
+      if (addr + i >= size) { fault = true; return 0; }
+      value = (value << 8) | ram[addr + i];
+    }
+    return value;
+  }
+
+  static void NaiveStore32LE(uint8_t *ram, uint64_t size, uint64_t addr, uint32_t value, bool &fault) {
+    for (unsigned i = 0; i < 4; i++) {
+      if (addr + i >= size) { fault = true; return; }
+      ram[addr + i] = uint8_t(value >> (8 * i));
+    }
+  }
+
+  // Nanoseconds per `access(addr)`, over `count` mostly unaligned
+  // addresses inside a cache-resident window; `sum` folds the results so
+  // that variants can be checked against each other.
+  template <typename Fn>
+  static double NsPerAccess(uint64_t count, uint64_t window, uint64_t &sum, Fn &&access) {
+    typedef std::chrono::steady_clock Clock;
+    uint64_t addr = 0;
+    sum = 0;
+    auto begin = Clock::now();
+    for (uint64_t i = 0; i < count; i++) {
+      sum += access(addr);
+      addr = (addr + 13) & (window / 2 - 1);
+    }
+    auto elapsed = Clock::now() - begin;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / count;
+  }
+
+  static void MeasureMemView(uint64_t count, Result &result, bool record) {
+    constexpr uint64_t Window = 256 << 10;
+    std::vector<uint8_t> ram(Window);
+    for (uint64_t i = 0; i < Window; i++) ram[i] = uint8_t(i * 131 + 7);
+
+    const tinyw::le_view<tinyw::bounds::checked> checked(ram.data(), Window);
+    const tinyw::le_view<tinyw::bounds::masked> masked(ram.data(), Window);
+    const tinyw::le_view<tinyw::bounds::unchecked> unchecked(ram.data(), Window);
+    const tinyw::be_view<tinyw::bounds::checked> big(ram.data(), Window);
+    bool fault = false;
+    uint64_t sums[8];
+
+    const std::pair<const char*, double> samples[] = {
+      { "naive_le32_ns", NsPerAccess(count, Window, sums[0], [&](uint64_t a) { return NaiveLoad32LE(ram.data(), Window, a, fault); }) },
+      { "view_le32_checked_ns", NsPerAccess(count, Window, sums[1], [&](uint64_t a) { return checked.u32(a); }) },
+      { "view_le32_masked_ns", NsPerAccess(count, Window, sums[2], [&](uint64_t a) { return masked.u32(a); }) },
+      { "view_le32_unchecked_ns", NsPerAccess(count, Window, sums[3], [&](uint64_t a) { return unchecked.u32(a); }) },
+      { "naive_be64_ns", NsPerAccess(count, Window, sums[4], [&](uint64_t a) { return NaiveLoad64BE(ram.data(), Window, a, fault); }) },
+      { "view_be64_checked_ns", NsPerAccess(count, Window, sums[5], [&](uint64_t a) { return big.u64(a); }) },
+      { "naive_store_le32_ns", NsPerAccess(count, Window, sums[6], [&](uint64_t a) {
+          NaiveStore32LE(ram.data(), Window, a, uint32_t(a), fault); return uint64_t(ram[a]); }) },
+      { "view_store_le32_checked_ns", NsPerAccess(count, Window, sums[7], [&](uint64_t a) {
+          checked.store<uint32_t>(a, uint32_t(a)); return uint64_t(ram[a]); }) },
+    };
+
+    if (fault || checked.faulted() || big.faulted() || sums[0] != sums[1] || sums[0] != sums[2] || sums[0] != sums[3] ||
+        sums[4] != sums[5] || sums[6] != sums[7])
+      therr(func, "mem_view and the byte loops disagree");
+    if (!record) return;
+    for (const auto &[name, ns] : samples) result[name].samples.push_back(ns);
+  }
+
+private:
+  std::vector<std::string> run_args_;    // `-core`/`-cpu`/`-gpu`/`-mem` pairs for every run
+  std::vector<std::string> only_;
+  size_t reps_ = 5, warmup_ = 1;
+  double scale_ = 1.0;
+  fs::path json_;
+  bool list_ = false;
+
+  static constexpr double Ms = 1e3;
+
+  std::string ModuleFile(const std::string &who, const std::string &fallback) const {
+    for (size_t i = 0; i + 2 < run_args_.size(); i += 3)
+      if (run_args_[i] == "-" + who && run_args_[i + 1] == "file") return run_args_[i + 2];
+    return fallback;
+  }
+
+  bool IsReference() const {
+    return ModuleFile("cpu", "") == "" && ModuleFile("gpu", "") == "" && ModuleFile("mem", "") == "";
+  }
+
+  std::vector<std::string> RunArgs(const fs::path &image) const {
+    std::vector<std::string> args = { "run", "-file", image.string(),
+      "-cpu", "file", ModuleFile("cpu", TinyWBuiltinPrefix "refcpu"),
+      "-gpu", "file", ModuleFile("gpu", TinyWBuiltinPrefix "nullgpu"),
+      "-mem", "file", ModuleFile("mem", TinyWBuiltinPrefix "flatmem"),
+      "-mem", "size", "16M" };
+    for (size_t i = 0; i + 2 < run_args_.size(); i += 3) {
+      if (run_args_[i + 1] == "file") continue;
+      args.insert(args.end(), { run_args_[i], run_args_[i + 1], run_args_[i + 2] });
+    }
+    return args;
+  }
+
+  // One run: load, start, tear down. The run itself is timed inside the
+  // reference CPU when it is used (its probe), else on the host around the 
+  // CPU module's run loop; shutdown is whatever follows until `Start` returns.
+  void RunOnce(const Workload &w, const fs::path &image, Result &result, bool record) {
+    typedef std::chrono::steady_clock Clock;
+    auto seconds = [](int64_t from, int64_t to) { return std::chrono::duration<double>(Clock::duration(to - from)).count(); };
+    if (w.measure) return w.measure(result, record);
+
+    auto &probe = builtin::reference_probe();
+    probe.Reset();
+
+    Core core;
+    auto begin = Clock::now();
+    core.Load(RunArgs(image));
+    auto loaded = Clock::now();
+    core.Start();
+    auto end = Clock::now();
+
+    const int64_t t_loaded = loaded.time_since_epoch().count(), t_end = end.time_since_epoch().count();
+    const int64_t began = core.GetRunBegan() ? core.GetRunBegan() : t_loaded;
+    const int64_t ended = core.GetRunEnded() ? core.GetRunEnded() : t_end;
+    const int64_t started = probe.cpu_started.load() ? probe.cpu_started.load() : began;
+    const int64_t halted = probe.cpu_halted.load() ? probe.cpu_halted.load() : ended;
+    const double run = seconds(started, halted);
+
+    if (IsReference() && probe.instructions.load() != w.instructions)
+      therr(func, AnyString("Workload `") | w.name | "` ran " | probe.instructions.load() | " instructions, expected " | w.instructions);
+    // builtin:nullgpu counts what it got, whichever CPU sent it.
+    if (ModuleFile("gpu", "") == "" && probe.gpu_bytes.load() != w.sent_bytes)
+      therr(func, AnyString("Workload `") | w.name | "` delivered " | probe.gpu_bytes.load() | " bytes to the GPU, expected " | w.sent_bytes);
+    if (ModuleFile("gpu", "") == "" && probe.gpu_checksum.load() != w.checksum)
+      therr(func, AnyString("Workload `") | w.name | "` sent checksum " | probe.gpu_checksum.load() | ", expected " | w.checksum);
+    if (!record) return;
+
+    result["startup_ms"].samples.push_back(std::chrono::duration<double>(loaded - begin).count() * Ms);
+    result["run_ms"].samples.push_back(run * Ms);
+    result["shutdown_ms"].samples.push_back(seconds(halted, t_end) * Ms);
+    result["total_ms"].samples.push_back(std::chrono::duration<double>(end - begin).count() * Ms);
+    if (run > 0) result["mips"].samples.push_back(w.instructions / run / 1e6);
+
+    if (w.streams) {
+      // Until the GPU got the last record, not just until the CPU pushed it.
+      double delivered = seconds(started, std::max(halted, probe.gpu_last.load()));
+      if (delivered > 0) {
+        result["send_mrec_per_s"].samples.push_back(w.sent_records / delivered / 1e6);
+        result["send_mib_per_s"].samples.push_back(w.sent_bytes / delivered / (1 << 20));
+      }
+    }
+    if (w.copied_bytes && run > 0) result["copy_gib_per_s"].samples.push_back(w.copied_bytes / run / (1 << 30));
+  }
+
+  static void PrintTable(std::ostream &out, const std::vector<Result> &results) {
+    size_t width = 22;
+    for (const auto &result : results)
+      for (const auto &[name, stat] : result.stats) width = std::max(width, result.workload->name.size() + name.size() + 3);
+
+    out << std::left << std::setw(width + 2) << "> workload/metric" << std::right << std::setw(12) << "mean"
+        << std::setw(12) << "stddev" << std::setw(8) << "cv%" << std::setw(12) << "min"
+        << std::setw(12) << "median" << std::setw(12) << "max" << "\n";
+    out << std::fixed << std::setprecision(3);
+    for (const auto &result : results) {
+      for (const auto &[name, stat] : result.stats) {
+        double mean = stat.Mean();
+        out << "> " << std::left << std::setw(width) << (result.workload->name + "/" + name) << std::right
+            << std::setw(12) << mean << std::setw(12) << stat.StdDev()
+            << std::setw(8) << std::setprecision(1) << (mean ? 100 * stat.StdDev() / mean : 0.0) << std::setprecision(3)
+            << std::setw(12) << stat.Min() << std::setw(12) << stat.Median() << std::setw(12) << stat.Max() << "\n";
+      }
+    }
+    out.unsetf(std::ios::floatfield);
+    out << std::flush;
+  }
+
+  std::string ToJSON(const std::vector<Result> &results) const {
+    auto number = [](double v) { std::ostringstream s; s << std::setprecision(9) << v; return s.str(); };
+    std::ostringstream out;
+    out << "{\n  \"tool\": \"tinyw bench\",\n  \"format\": 1,\n";
+    out << "  \"host\": { \"cpus\": " << std::thread::hardware_concurrency()
+#if defined(__VERSION__)
+        << ", \"compiler\": \"" << json_escape(__VERSION__) << "\""
+#endif
+        << " },\n";
+    out << "  \"config\": { \"reps\": " << reps_ << ", \"warmup\": " << warmup_ << ", \"scale\": " << number(scale_)
+        << ", \"cpu\": \"" << json_escape(ModuleFile("cpu", TinyWBuiltinPrefix "refcpu"))
+        << "\", \"gpu\": \"" << json_escape(ModuleFile("gpu", TinyWBuiltinPrefix "nullgpu"))
+        << "\", \"mem\": \"" << json_escape(ModuleFile("mem", TinyWBuiltinPrefix "flatmem")) << "\", \"args\": [";
+    for (size_t i = 0; i < run_args_.size(); i++) out << (i ? ", " : "") << "\"" << json_escape(run_args_[i]) << "\"";
+    out << "] },\n  \"workloads\": [";
+
+    for (size_t r = 0; r < results.size(); r++) {
+      const auto &result = results[r];
+      const auto &w = *result.workload;
+      out << (r ? "," : "") << "\n    { \"name\": \"" << json_escape(w.name) << "\", \"instructions\": " << w.instructions
+          << ", \"sent_bytes\": " << w.sent_bytes << ", \"copied_bytes\": " << w.copied_bytes << ", \"metrics\": {";
+      for (size_t m = 0; m < result.stats.size(); m++) {
+        const auto &[name, stat] = result.stats[m];
+        out << (m ? "," : "") << "\n        \"" << name << "\": { \"mean\": " << number(stat.Mean())
+            << ", \"stddev\": " << number(stat.StdDev()) << ", \"min\": " << number(stat.Min())
+            << ", \"median\": " << number(stat.Median()) << ", \"max\": " << number(stat.Max()) << ", \"samples\": [";
+        for (size_t i = 0; i < stat.samples.size(); i++) out << (i ? ", " : "") << number(stat.samples[i]);
+        out << "] }";
+      }
+      out << "\n      } }";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+  }
+
+public:
+  // tinyw bench [-reps <N>] [-warmup <N>] [-scale <factor>] [-workload <a,b,..>]
+  //             [-json <path|->] [-list] [-cpu|-gpu|-mem|-core <key> <value>]...
+  void ParseArguments(const std::vector<std::string> &args) {
+    for (size_t i = 0; i < args.size(); i++) {
+      auto arg = to_lowercase(args[i]);
+      if (arg == "-reps" && i + 1 < args.size()) reps_ = std::max<size_t>(1, std::stoul(args[++i]));
+      else if (arg == "-warmup" && i + 1 < args.size()) warmup_ = std::stoul(args[++i]);
+      else if (arg == "-scale" && i + 1 < args.size()) scale_ = std::stod(args[++i]);
+      else if (arg == "-json" && i + 1 < args.size()) json_ = args[++i];
+      else if (arg == "-list") list_ = true;
+      else if (arg == "-workload" && i + 1 < args.size()) {
+        std::stringstream names(args[++i]);
+        for (std::string name; std::getline(names, name, ',');) if (!name.empty()) only_.push_back(name);
+      } else if ((arg == "-cpu" || arg == "-gpu" || arg == "-mem" || arg == "-core") && i + 2 < args.size()) {
+        run_args_.insert(run_args_.end(), { arg, args[i + 1], args[i + 2] });
+        i += 2;
+      } else therr(func, "Unknown bench argument: `" + args[i] + "`");
+    }
+    if (scale_ <= 0) therr(func, "`-scale` must be positive");
+  }
+
+  void Run() {
+    auto workloads = StandardWorkloads(scale_);
+
+    if (list_) {
+      std::cout << "> workloads:\n";
+      for (const auto &w : workloads) std::cout << ">   " << std::left << std::setw(10) << w.name << w.description << "\n";
+      std::cout << "> builtin modules:\n";
+      for (const auto &[name, module] : builtin_modules())
+        std::cout << ">   " << std::left << std::setw(24) << (TinyWBuiltinPrefix + name) << std::setw(8) << module.kind << module.description << "\n";
+      std::cout << std::right << std::flush;
+      return;
+    }
+
+    for (const auto &name : only_) {
+      if (std::none_of(workloads.begin(), workloads.end(), [&](const Workload &w) { return w.name == name; }))
+        therr(func, "Unknown workload: `" + name + "` (see `tinyw bench -list`)");
+    }
+
+#if defined(_WIN32)
+    const auto pid = std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+#else
+    const auto pid = std::to_string(getpid());
+#endif
+    const auto dir = fs::temp_directory_path() / ("tinyw-bench-" + pid);
+    fs::create_directories(dir);
+
+    // Module chatter would end up in the measurements.
+    auto ui = task_ui_mode();
+    task_ui_mode() = TaskUIMode::Quiet;
+
+    std::vector<Result> results;
+    try {
+      for (const auto &w : workloads) {
+        if (!only_.empty() && std::find(only_.begin(), only_.end(), w.name) == only_.end()) continue;
+
+        auto image = dir / (w.name + ".bin");
+        if (!w.measure) std::ofstream(image, std::ios::binary).write((const char*)w.image.data(), w.image.size());
+
+        Result result{ &w, {} };
+        for (size_t rep = 0; rep < warmup_ + reps_; rep++) RunOnce(w, image, result, rep >= warmup_);
+        results.push_back(std::move(result));
+      }
+    } catch (...) {
+      task_ui_mode() = ui;
+      fs::remove_all(dir);
+      throw;
+    }
+    task_ui_mode() = ui;
+    fs::remove_all(dir);
+
+    std::cout << "> " << reps_ << " repetitions (+" << warmup_ << " warm-up) per workload, scale " << scale_
+              << (IsReference() ? ", reference modules" : "") << "\n";
+    PrintTable(std::cout, results);
+
+    if (json_.empty()) return;
+    auto json = ToJSON(results);
+    if (json_ == "-") std::cout << json;
+    else {
+      std::ofstream out(json_);
+      if (!(out << json)) therr(func, "Cannot write " + json_.string());
+      std::cout << "> results written to " << json_.string() << std::endl;
+    }
+  }
+};
+
+TinyWDeclEnd
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include "glob.hpp"
+#include "sys.hpp"
+
+TinyWDeclStart
+
+// Reference modules compiled into tinyw: `builtin:flatmem`, `builtin:nullgpu`
+// and `builtin:refcpu`. They back `tinyw bench`, give a known baseline when
+// comparing module builds, and can be used with `run` like any module file.
+// All three use the instance ABI, so any number of VMs can share them.
+namespace builtin {
+
+// Host-side view of the last reference run, read by `tinyw bench`.
+struct ReferenceProbe {
+  std::atomic<int64_t> cpu_started{0};    // steady_clock ticks
+  std::atomic<int64_t> cpu_halted{0};
+  std::atomic<uint64_t> instructions{0};
+  std::atomic<uint64_t> gpu_records{0};
+  std::atomic<uint64_t> gpu_bytes{0};
+  std::atomic<int64_t> gpu_last{0};
+  std::atomic<uint64_t> gpu_checksum{0};  // sum of the first 8 bytes of every record
+
+  void Reset() {
+    cpu_started = cpu_halted = gpu_last = 0;
+    instructions = gpu_records = gpu_bytes = gpu_checksum = 0;
+  }
+
+  static int64_t Now() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+};
+
+inline ReferenceProbe &reference_probe() {
+  static ReferenceProbe probe;
+  return probe;
+}
+
+// --- builtin:flatmem ---------------------------------------------------------
+// One RWX region at guest address 0: host-allocated RAM (`-mem size`) when
+// attached, else its own `-mem flat-size` bytes (16M by default).
+
+struct FlatMemory {
+  std::unique_ptr<uint8_t[]> own;
+  uint8_t *ram = nullptr;
+  uint64_t size = 0;
+  uint32_t page_size = 4096;
+  tinyw_mem_region region{};
+  tinyw_mem_map map{};
+};
+
+inline tinyw_instance flatmem_create() { return new FlatMemory(); }
+inline void flatmem_destroy(tinyw_instance self) { delete static_cast<FlatMemory*>(self); }
+
+inline void flatmem_attach_memory(tinyw_instance self, uint8_t *ram, uint64_t size, uint32_t page_size) {
+  auto &m = *static_cast<FlatMemory*>(self);
+  m.ram = ram;
+  m.size = size;
+  m.page_size = page_size;
+}
+
+inline void flatmem_init(tinyw_instance self, uint64_t argc, char *const argv[]) {
+  auto &m = *static_cast<FlatMemory*>(self);
+  if (!m.ram) {
+    m.size = 16 << 20;
+    for (uint64_t i = 0; i + 1 < argc; i++) if (std::string(argv[i]) == "flat-size") m.size = parse_size(argv[i + 1]);
+    m.own = std::make_unique<uint8_t[]>(m.size);
+    m.ram = m.own.get();
+  }
+  m.region = tinyw_mem_region{ .base = m.ram, .guest_addr = 0, .size = m.size,
+                               .flags = TINYW_REGION_RW | TINYW_REGION_EXEC, .page_size = m.page_size };
+  m.map = tinyw_mem_map{ .version = TINYW_MEM_MAP_VERSION, .count = 1, .regions = &m.region };
+}
+
+inline const tinyw_mem_map *flatmem_get_memory_map(tinyw_instance self) { return &static_cast<FlatMemory*>(self)->map; }
+
+inline void flatmem_load_image(tinyw_instance self, uint8_t *image, uint64_t len, uint64_t offset) {
+  auto &m = *static_cast<FlatMemory*>(self);
+  if (offset > m.size || len > m.size - offset) therr(func, "Program image does not fit in builtin:flatmem");
+  std::memcpy(m.ram + offset, image, len);
+}
+
+inline void flatmem_clear(tinyw_instance self) {
+  auto &m = *static_cast<FlatMemory*>(self);
+  m.own.reset();
+  m.ram = nullptr;
+  m.map.count = 0;
+}
+
+// --- builtin:nullgpu ---------------------------------------------------------
+// Takes everything and renders nothing; counts what it was sent and sums 
+// the first word of each record, so that a program can report a result.
+
+struct NullGPU {};
+
+inline tinyw_instance nullgpu_create() { return new NullGPU(); }
+inline void nullgpu_destroy(tinyw_instance self) { delete static_cast<NullGPU*>(self); }
+inline void nullgpu_init(tinyw_instance, uint64_t, char *const[]) {}
+inline void nullgpu_start(tinyw_instance) {}
+inline void nullgpu_stop(tinyw_instance) {}
+inline uint64_t nullgpu_step(tinyw_instance, uint64_t) { return 0; }
+
+inline void nullgpu_send_bytes(tinyw_instance, uint8_t *bytes, uint64_t len) {
+  auto &probe = reference_probe();
+  if (len >= 8) {
+    uint64_t word;
+    std::memcpy(&word, bytes, 8);
+    probe.gpu_checksum.fetch_add(word, std::memory_order_relaxed);
+  }
+  probe.gpu_records.fetch_add(1, std::memory_order_relaxed);
+  probe.gpu_bytes.fetch_add(len, std::memory_order_relaxed);
+  probe.gpu_last.store(ReferenceProbe::Now(), std::memory_order_relaxed);
+}
+
+// --- builtin:refcpu ----------------------------------------------------------
+// A small register machine: 16 64-bit registers, 4-byte instructions
+// `op a b c` (LI is followed by an 8-byte immediate), execution from guest
+// address 0 of the first memory region until HALT. Memory operands are
+// guest addresses held in registers. This is the plain switch loop:
+// modules/fastcpu.cpp runs the same bytecode with the techniques a fast
+// interpreter uses, as a module.
+enum class RefOp : uint8_t {
+  Halt = 0x00,  // stop the run
+  Li   = 0x01,  // ra = imm64
+  Add  = 0x02,  // ra = rb + rc
+  Sub  = 0x03,  // ra = rb - rc
+  Addi = 0x04,  // ra = rb + (int8_t)c
+  Ld   = 0x05,  // ra = mem64[rb]
+  St   = 0x06,  // mem64[rb] = ra
+  Bnz  = 0x07,  // if ra != 0: pc += 4 * (int16_t)(b | c << 8), from the next instruction
+  Send = 0x08,  // push mem[ra, ra + rb) to the GPU queue
+  Copy = 0x09,  // memmove(mem[ra], mem[rb], rc)
+  Xor  = 0x0a,  // ra = rb ^ rc
+  Mul  = 0x0b,  // ra = rb * rc
+};
+
+// Builds reference CPU programs.
+class RefAssembler {
+  std::vector<uint8_t> code_;
+
+public:
+  typedef size_t Label;
+
+  RefAssembler &Op(RefOp op, uint8_t a = 0, uint8_t b = 0, uint8_t c = 0) {
+    code_.insert(code_.end(), { (uint8_t)op, a, b, c });
+    return *this;
+  }
+
+  RefAssembler &Li(uint8_t reg, uint64_t value) {
+    Op(RefOp::Li, reg);
+    for (int i = 0; i < 8; i++) code_.push_back(uint8_t(value >> (8 * i)));
+    return *this;
+  }
+
+  Label Here() const { return code_.size(); }
+
+  RefAssembler &Bnz(uint8_t reg, Label target) {
+    int64_t delta = ((int64_t)target - (int64_t)(code_.size() + 4)) / 4;
+    if (delta < INT16_MIN || delta > INT16_MAX) therr(func, "Branch out of range");
+    return Op(RefOp::Bnz, reg, uint8_t(delta & 0xff), uint8_t((delta >> 8) & 0xff));
+  }
+
+  const std::vector<uint8_t> &Code() const { return code_; }
+};
+
+struct ReferenceCPU {
+  uint8_t *ram = nullptr;
+  uint64_t base = 0, size = 0;
+  const tinyw_gpu_queue *queue = nullptr;
+  const tinyw_stop_token *stop = nullptr;
+  uint64_t reg[16] = {};
+  uint64_t pc = 0;
+  uint64_t executed = 0;
+  bool halted = false;
+
+  uint8_t *At(uint64_t addr, uint64_t len) {
+    if (addr < base || addr - base > size || len > size - (addr - base))
+      therr(func, AnyString("builtin:refcpu: access outside of guest memory at ") | addr);
+    return ram + (addr - base);
+  }
+
+
+  // Runs at most `budget` instructions, returns how many ran.
+  uint64_t Run(uint64_t budget) {
+    uint64_t done = 0;
+    for (; done < budget && !halted; done++) {
+      const uint8_t *in = At(pc, 4);
+      const uint8_t a = in[1] & 15, b = in[2] & 15, c = in[3] & 15;
+      pc += 4;
+      switch ((RefOp)in[0]) {
+        case RefOp::Halt: halted = true; break;
+        case RefOp::Li:   std::memcpy(&reg[a], At(pc, 8), 8); pc += 8; break;
+        case RefOp::Add:  reg[a] = reg[b] + reg[c]; break;
+        case RefOp::Sub:  reg[a] = reg[b] - reg[c]; break;
+        case RefOp::Addi: reg[a] = reg[b] + (int8_t)in[3]; break;
+        case RefOp::Ld:   std::memcpy(&reg[a], At(reg[b], 8), 8); break;
+        case RefOp::St:   std::memcpy(At(reg[b], 8), &reg[a], 8); break;
+        case RefOp::Bnz:  if (reg[a]) pc += 4 * (int64_t)(int16_t)(in[2] | in[3] << 8); break;
+        case RefOp::Send:
+          if (queue && queue->push(queue->ctx, At(reg[a], reg[b]), reg[b]) == TINYW_QUEUE_CLOSED) halted = true;
+          break;
+        case RefOp::Copy: std::memmove(At(reg[a], reg[c]), At(reg[b], reg[c]), reg[c]); break;
+        case RefOp::Xor:  reg[a] = reg[b] ^ reg[c]; break;
+        case RefOp::Mul:  reg[a] = reg[b] * reg[c]; break;
+        default: therr(func, AnyString("builtin:refcpu: invalid opcode ") | (int)in[0] | " at " | (pc - 4));
+      }
+    }
+    executed += done;
+    if (halted) {
+      auto &probe = reference_probe();
+      probe.instructions.fetch_add(executed, std::memory_order_relaxed);
+      probe.cpu_halted.store(ReferenceProbe::Now(), std::memory_order_relaxed);
+    }
+    return done;
+  }
+};
+
+inline tinyw_instance refcpu_create() { return new ReferenceCPU(); }
+inline void refcpu_destroy(tinyw_instance self) { delete static_cast<ReferenceCPU*>(self); }
+
+inline int32_t refcpu_attach(tinyw_instance self, uint32_t kind, const void *resource) {
+  auto &cpu = *static_cast<ReferenceCPU*>(self);
+  if (kind == TINYW_ATTACH_GPU_QUEUE) cpu.queue = static_cast<const tinyw_gpu_queue*>(resource);
+  else if (kind == TINYW_ATTACH_STOP_TOKEN) cpu.stop = static_cast<const tinyw_stop_token*>(resource);
+  else return 0;
+  return 1;
+}
+
+inline void refcpu_init(tinyw_instance self, const tinyw_mem_map *map, uint64_t, char *const[]) {
+  auto &cpu = *static_cast<ReferenceCPU*>(self);
+  if (!map || !map->count) therr(func, "builtin:refcpu needs at least one memory region");
+  cpu.ram = map->regions[0].base;
+  cpu.base = cpu.pc = map->regions[0].guest_addr;
+  cpu.size = map->regions[0].size;
+}
+
+inline void refcpu_start(tinyw_instance self) {
+  auto &cpu = *static_cast<ReferenceCPU*>(self);
+  reference_probe().cpu_started.store(ReferenceProbe::Now(), std::memory_order_relaxed);
+  while (!cpu.halted) {
+    cpu.Run(1 << 16);
+    if (cpu.stop && std::atomic_ref<const uint32_t>(*cpu.stop->flag).load(std::memory_order_relaxed)) break;
+  }
+}
+
+inline uint64_t refcpu_step(tinyw_instance self, uint64_t budget) {
+  auto &cpu = *static_cast<ReferenceCPU*>(self);
+  if (cpu.halted) return TINYW_STEP_HALTED;
+  if (!cpu.executed) reference_probe().cpu_started.store(ReferenceProbe::Now(), std::memory_order_relaxed);
+  return cpu.Run(budget);
+}
+
+inline void refcpu_stop(tinyw_instance) {}
+
+// Instance entry points take the handle first: the `_i` names of the ABI.
+inline const bool RegisteredReferenceModules = [] {
+  register_builtin_module("flatmem", {
+    .kind = "memory",
+    .description = "flat RWX memory at guest address 0 (-mem size, or -mem flat-size)",
+    .symbols = {
+      { "create_instance",  (void*)&flatmem_create },
+      { "destroy_instance", (void*)&flatmem_destroy },
+      { "init_i",           (void*)&flatmem_init },
+      { "get_memory_map_i", (void*)&flatmem_get_memory_map },
+      { "load_image_i",     (void*)&flatmem_load_image },
+      { "attach_memory_i",  (void*)&flatmem_attach_memory },
+      { "clear_i",          (void*)&flatmem_clear },
+    },
+  });
+  register_builtin_module("nullgpu", {
+    .kind = "gpu",
+    .description = "discards and counts everything sent to it",
+    .symbols = {
+      { "create_instance",  (void*)&nullgpu_create },
+      { "destroy_instance", (void*)&nullgpu_destroy },
+      { "init_i",           (void*)&nullgpu_init },
+      { "start_i",          (void*)&nullgpu_start },
+      { "stop_i",           (void*)&nullgpu_stop },
+      { "step_i",           (void*)&nullgpu_step },
+      { "send_bytes_i",     (void*)&nullgpu_send_bytes },
+    },
+  });
+  register_builtin_module("refcpu", {
+    .kind = "cpu",
+    .description = "reference bytecode CPU (see builtin.hpp)",
+    .symbols = {
+      { "create_instance",  (void*)&refcpu_create },
+      { "destroy_instance", (void*)&refcpu_destroy },
+      { "attach_i",         (void*)&refcpu_attach },
+      { "init_i",           (void*)&refcpu_init },
+      { "start_i",          (void*)&refcpu_start },
+      { "stop_i",           (void*)&refcpu_stop },
+      { "step_i",           (void*)&refcpu_step },
+    },
+  });
+  return true;
+}();
+
+} // namespace builtin
+
+TinyWDeclEnd
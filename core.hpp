@@ -1,5 +1,6 @@
 #pragma once
 
+#include <latch>
 #include <thread>
 #include <chrono>
 #include <atomic>
@@ -10,6 +11,7 @@
 #include <sstream>
 #include <cstdint>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <stdexcept>
 #include <exception>
@@ -23,21 +25,404 @@
 #include "cpu.hpp"
 #include "gpu.hpp"
 #include "mem.hpp"
+#include "ring.hpp"
+#include "stop.hpp"
+#include "affinity.hpp"
+#include "snapshot.hpp"
+#include "damage.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "services.hpp"
 
 TinyWDeclStart
 
 class Core {
 private:
+  // Declared first: modules may use their table until they are unloaded.
+  HostServices CPUHost{"cpu"}, GPUHost{"gpu"}, MemoryHost{"memory"};
   CPU MyCPU;
   GPU MyGPU;
   Memory MyMemory;
-  std::atomic<bool> should_stop{false};
+  ProgramImage MyImage;
+  GuestRAM MyRAM;
+  std::unique_ptr<CommandRing> MyRing;
+  tinyw_gpu_queue MyQueue{};
+  size_t RingBatch = 64;
+  tinyw_framebuffer MyFramebuffer{};
+  alignas(8) uint64_t FrameSequence = 0;
+  std::unique_ptr<FramebufferDamage> MyDamage;
+  std::chrono::nanoseconds DamagePoll{0};
+  StopSource MyStop;
+  tinyw_smp MySMP{};
+  ThreadPlacement CPUPlacement, GPUPlacement;
+  bool Lockstep = false;
+  bool GPURunning = true;
+  uint64_t Quantum = 10000;
+  std::vector<fs::path> ModuleFiles;
+  std::unique_ptr<Snapshotter> MySnapshot;
+  uint64_t SnapshotEvery = 0;
+  std::chrono::nanoseconds SnapshotInterval{0};
+  Watchdog MyWatchdog;
+  std::unique_ptr<RunMetrics> MyMetrics;
+  fs::path MetricsPath;
+  Histogram SendSize, SendLatency;
+  std::chrono::steady_clock::duration CPUStepTime{}, GPUStepTime{};
+  std::chrono::steady_clock::time_point Loaded;
+  // Host-side bounds of the guest run (steady_clock ticks): when the first 
+  // CPU core entered the module's run loop and when the last one left it.
+  std::atomic<int64_t> RunBegan{0}, RunEnded{0};
+  std::vector<std::string> CoreArgs;
+
+  static std::string GetOption(const std::vector<std::string> &args, const std::string &key, 
+                               const std::string &fallback = "") {
+    for (size_t i = 0; i + 1 < args.size(); ++i) {
+      if (args[i] == key) return args[i + 1];
+    }
+    return fallback;
+  }
+
+  // -core image-load <lazy|populate|willneed>, -core image-offset <guest address>
+  void LoadImage(const fs::path &exec_file, const std::vector<std::string> &core_args) {
+    if (!MyMemory.can_load_image()) {
+      task_out() << "> memory module has no `load_image`, program image not loaded" << std::endl;
+      return;
+    }
+
+    auto mode = ProgramImage::ParseLoadMode(GetOption(core_args, "image-load", "lazy"));
+    auto offset = std::stoull(GetOption(core_args, "image-offset", "0"), nullptr, 0);
+
+    MyImage.Map(exec_file, mode);
+    MyMemory.load_image(MyImage, offset);
+  }
+
+  // -mem size <bytes> [-mem hugepages <off|thp|2M|1G>]: guest RAM is then 
+  // allocated by the host and attached to the memory module.
+  void AllocateGuestRAM(const std::vector<std::string> &args_mem) {
+    auto size = GetOption(args_mem, "size");
+    auto huge = to_lowercase(GetOption(args_mem, "hugepages", "off"));
+    if (size.empty()) {
+      if (huge != "off") therr(func, "`-mem hugepages` requires `-mem size`");
+      return;
+    }
+
+    uint64_t huge_page = 0;
+    if (huge == "thp") huge_page = 1;
+    else if (huge != "off") huge_page = parse_size(huge);
+    if (huge_page > 1 && (huge_page & (huge_page - 1))) therr(func, "Huge page size must be a power of two: " + huge);
+
+    MyRAM.Allocate(parse_size(size), huge_page);
+  }
+
+  // -core ring-size <bytes>, -core ring-batch <records per wake-up>, 
+  // -core ring-policy <block|drop|overwrite>
+  void CreateRing(const std::vector<std::string> &core_args) {
+    MyRing = std::make_unique<CommandRing>(
+      parse_size(GetOption(core_args, "ring-size", "1M")), 
+      CommandRing::ParsePolicy(GetOption(core_args, "ring-policy", "block")));
+    RingBatch = std::max<size_t>(1, std::stoull(GetOption(core_args, "ring-batch", "64")));
+    MyQueue = MyRing->AsQueue(MySMP.core_count > 1);
+  }
+
+  // -core <cpu|gpu>-affinity <cpu list>, -core <cpu|gpu>-sched <other|fifo:N|rr:N>, 
+  // -core <cpu|gpu>-nice <N>. The GPU settings also apply to the ring drain.
+  static ThreadPlacement ParsePlacement(const std::vector<std::string> &core_args, const std::string &who) {
+    ThreadPlacement placement;
+    auto cpus = GetOption(core_args, who + "-affinity");
+    if (!cpus.empty()) placement.cpus = parse_cpu_list(cpus);
+    auto sched = GetOption(core_args, who + "-sched");
+    if (!sched.empty()) parse_sched_policy(sched, placement);
+    auto nice = GetOption(core_args, who + "-nice");
+    if (!nice.empty()) placement.has_nice = true, placement.nice = std::stoi(nice);
+    return placement;
+  }
+
+  // SMP cores each get their own host CPU when the set is large enough.
+  ThreadPlacement CorePlacement(uint32_t id, uint32_t cores) const {
+    auto placement = CPUPlacement;
+    if (cores > 1 && placement.cpus.size() >= cores) placement.cpus = { placement.cpus[id] };
+    return placement;
+  }
+
+  // -core numa <auto|off|node>: guest RAM follows the first CPU thread by 
+  // default, when it is pinned.
+  void BindGuestRAM(const std::vector<std::string> &core_args) {
+    auto numa = to_lowercase(GetOption(core_args, "numa", "auto"));
+    if (!MyRAM.Data() || numa == "off") return;
+
+    int node = -1;
+    if (numa == "auto") {
+      if (CPUPlacement.cpus.empty()) return;
+      node = numa_node_of_cpu(CPUPlacement.cpus.front());
+      if (node < 0) return;
+    } else node = std::stoi(numa);
+
+    auto error = bind_memory_to_node(MyRAM.Data(), MyRAM.Size(), node);
+    if (!error.empty()) std::cerr << "> [i:warn]: cannot bind guest memory to NUMA node " << node << ": " << error << std::endl;
+    else task_out() << "> guest memory bound to NUMA node " << node << std::endl;
+  }
+
+  // -core sched <threads|lockstep>, -core quantum <cycles>. Lockstep needs 
+  // `step` on both modules and a single core, else the run stays threaded.
+  void SetupScheduler(const std::vector<std::string> &core_args) {
+    auto sched = to_lowercase(GetOption(core_args, "sched", "threads"));
+    if (sched != "threads" && sched != "lockstep") therr(func, "Unknown scheduler: `" + sched + "` (expected threads or lockstep)");
+    Quantum = std::max<uint64_t>(1, std::stoull(GetOption(core_args, "quantum", "10000")));
+    Lockstep = false;
+    if (sched != "lockstep") return;
+
+    if (!MyCPU.can_step() || !MyGPU.can_step()) 
+      std::cerr << "> [i:warn]: lockstep needs `step` in both the CPU and GPU modules, running threaded" << std::endl;
+    else if (MySMP.core_count > 1) 
+      std::cerr << "> [i:warn]: lockstep does not support `-cpu count` > 1, running threaded" << std::endl;
+    else EnterLockstep();
+  }
+
+  // Hands everything the CPU queued so far to the GPU.
+  void Deliver() {
+    if (!MyRing) return;
+    while (MyRing->Drain([&](uint8_t *bytes, uint64_t len) { SendBytes(bytes, len); }, RingBatch)) {}
+  }
+
+  // Hands the damage of the latest presented frame, if any, to the GPU.
+  bool DeliverDamage() {
+    return MyDamage && MyDamage->Deliver([&](const tinyw_fb_damage_list &damage) { MyGPU.send_damage(damage); });
+  }
+
+  // -core restore <dir>: guest memory starts from a snapshot instead of the 
+  // freshly loaded image. -core snapshot <dir> [-core snapshot-tracking 
+  // <auto|mprotect|soft-dirty>] [-core snapshot-every <quanta>] 
+  // [-core snapshot-interval <duration>]: checkpoint guest memory, every N 
+  // quanta in lockstep, periodically when threaded, and at the end of the run.
+  // Only guest RAM is captured, module state is not.
+  void SetupSnapshots(const std::vector<std::string> &core_args) {
+    auto restore = GetOption(core_args, "restore");
+    auto snapshot = GetOption(core_args, "snapshot");
+    if (restore.empty() && snapshot.empty()) return;
+    if (!MyRAM.Data()) therr(func, "Snapshots need host-allocated guest memory (`-mem size`)");
+
+    if (!restore.empty()) {
+      auto deltas = Snapshotter::Restore(restore, MyRAM);
+      task_out() << "> restored guest memory from " << restore << " (base + " << deltas << " deltas)" << std::endl;
+    }
+
+    if (snapshot.empty()) return;
+    bool resume = !restore.empty() && fs::weakly_canonical(restore) == fs::weakly_canonical(snapshot);
+    MySnapshot = std::make_unique<Snapshotter>(snapshot, MyRAM, 
+      Snapshotter::ParseTracking(GetOption(core_args, "snapshot-tracking", "auto")), resume);
+    SnapshotEvery = std::stoull(GetOption(core_args, "snapshot-every", "0"));
+    SnapshotInterval = parse_duration(GetOption(core_args, "snapshot-interval", "0"));
+  }
+
+  // Final checkpoint, once the modules stopped writing.
+  void FinishSnapshots() {
+    if (!MySnapshot) return;
+    MySnapshot->StopPeriodic();
+    auto periodic = MySnapshot->PeriodicError();
+    if (!periodic.empty()) {
+      std::cerr << "> [i:warn]: periodic snapshot failed, snapshot left incomplete: " << periodic << std::endl;
+    } else {
+      try {
+        MySnapshot->Checkpoint();
+      } catch (const std::exception &e) {
+        std::cerr << "> [i:warn]: final snapshot failed: " << e.what() << std::endl;
+      }
+    }
+    MySnapshot->Stop();
+
+    auto stats = MySnapshot->GetStats();
+    task_out() << "> snapshot: " << stats.checkpoints << " checkpoints, " << stats.pages << " pages (" 
+               << format_size(stats.bytes) << "), last took " << format_elapsed(stats.last) << std::endl;
+    MySnapshot.reset();
+  }
+
+  // -core metrics <path>: module timings, `send_bytes` histograms and run 
+  // counters, written at exit as <path>.json and <path>.prom (see metrics.hpp). 
+  // Without it, nothing on the hot paths is timed.
+  void SetupMetrics(const std::vector<std::string> &core_args) {
+    auto path = GetOption(core_args, "metrics");
+    if (path.empty()) return;
+    MetricsPath = path;
+    MyMetrics = std::make_unique<RunMetrics>();
+    MyMetrics->AddSummary("tinyw_gpu_send_bytes_size_bytes", "Size of the buffers handed to the GPU's send_bytes", SendSize);
+    MyMetrics->AddSummary("tinyw_gpu_send_bytes_latency_seconds", "Time spent in one call of the GPU's send_bytes", SendLatency, 1e-9);
+  }
+
+  // -core trace <file> [-core trace-buffer <events per thread>]: Chrome 
+  // trace-event timeline of the host threads and traced modules, written 
+  // at exit and on SIGUSR1 (see trace.hpp).
+  void SetupTrace(const std::vector<std::string> &core_args) {
+    auto path = GetOption(core_args, "trace");
+    if (!path.empty()) tracer().Start(path, parse_size(GetOption(core_args, "trace-buffer", "64K")));
+  }
+
+  // -core log-level <debug|info|warn|error>: what module log lines are 
+  // printed. A module's `fail` stops the VM (see services.hpp).
+  void SetupHostServices(const std::vector<std::string> &core_args) {
+    auto level = HostServices::ParseLogLevel(GetOption(core_args, "log-level", "info"));
+    for (auto *host : { &CPUHost, &GPUHost, &MemoryHost }) 
+      host->Setup(level, MyStop.Token(), tracer().ABI(), [this] { RequestStop(); });
+  }
+
+  void ThrowIfModuleFailed() const {
+    for (auto *host : { &CPUHost, &GPUHost, &MemoryHost }) host->ThrowIfFailed();
+  }
+
+  // Runs `fn`; with `-core metrics`, reports how long the `phase` entry 
+  // point of `module` took.
+  template <typename Fn>
+  void Timed(const std::string &phase, const std::string &module, Fn &&fn, RunMetrics::Labels labels = {}) {
+    TraceSpan span(Tracer::Enabled() ? tracer().Intern(module + " " + phase) : nullptr);
+    if (!MyMetrics) return fn();
+    auto started = std::chrono::steady_clock::now();
+    fn();
+    labels.insert(labels.begin(), { "module", module });
+    MyMetrics->Time("tinyw_module_" + phase + "_seconds", "Seconds spent in a module's `" + phase + "`", 
+                    std::chrono::steady_clock::now() - started, labels);
+  }
+
+  void SendBytes(uint8_t *bytes, uint64_t len) {
+    TraceSpan span("gpu send_bytes", len);
+    if (!MyMetrics) return MyGPU.send_bytes(bytes, len);
+    auto started = std::chrono::steady_clock::now();
+    MyGPU.send_bytes(bytes, len);
+    SendLatency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());
+    SendSize.Record(len);
+  }
+
+  // RunFor with `-core metrics`, also summing the time of each step.
+  uint64_t TimedRunFor(uint64_t cycles) {
+    auto started = std::chrono::steady_clock::now();
+    uint64_t used = MyCPU.step(cycles);
+    auto stepped = std::chrono::steady_clock::now();
+    CPUStepTime += stepped - started;
+    Deliver();
+    DeliverDamage();
+    if (GPURunning) {
+      stepped = std::chrono::steady_clock::now();
+      if (MyGPU.step(cycles) == TINYW_STEP_HALTED) GPURunning = false;
+      GPUStepTime += std::chrono::steady_clock::now() - stepped;
+    }
+    return used;
+  }
+
+  void WriteMetrics() {
+    if (!MyMetrics) return;
+    auto &m = *MyMetrics;
+
+    const std::pair<const char*, const ModuleTimings*> modules[] = {
+      { "cpu", &MyCPU.get_timings() }, { "gpu", &MyGPU.get_timings() }, { "memory", &MyMemory.get_timings() },
+    };
+    for (size_t i = 0; i < 3; i++) {
+      RunMetrics::Labels labels = { { "module", modules[i].first }, { "file", ModuleFiles[i].string() } };
+      m.Time("tinyw_module_open_seconds", "Seconds spent loading a module library", modules[i].second->open, labels);
+      m.Time("tinyw_module_init_seconds", "Seconds spent in a module's `init`", modules[i].second->init, labels);
+    }
+
+    if (Lockstep) {
+      m.Time("tinyw_module_step_seconds", "Seconds spent in a module's `step`, summed", CPUStepTime, { { "module", "cpu" } });
+      m.Time("tinyw_module_step_seconds", "Seconds spent in a module's `step`, summed", GPUStepTime, { { "module", "gpu" } });
+    }
+
+    m.Time("tinyw_run_seconds", "Seconds from the end of loading to the end of the run", 
+           std::chrono::steady_clock::now() - Loaded, { { "sched", Lockstep ? "lockstep" : "threads" } });
+    m.Set("tinyw_cpu_cores", "CPU cores run over the CPU module", std::max<uint32_t>(1, MySMP.core_count));
+    m.Set("tinyw_gpu_send_bytes_calls", "Calls of the GPU's send_bytes", SendSize.Count());
+    m.Set("tinyw_gpu_send_bytes_bytes", "Bytes handed to the GPU's send_bytes", SendSize.Sum());
+
+    if (MyRing) {
+      auto stats = MyRing->GetStats();
+      m.Set("tinyw_gpu_ring_records", "Records pushed to the CPU -> GPU ring", stats.pushed);
+      m.Set("tinyw_gpu_ring_dropped", "Records dropped by the ring (drop policy)", stats.dropped);
+      m.Set("tinyw_gpu_ring_overwritten", "Records overwritten in the ring (overwrite policy)", stats.overwritten);
+      m.Set("tinyw_gpu_ring_high_water_bytes", "Highest ring occupancy", stats.high_water);
+      m.Set("tinyw_gpu_ring_capacity_bytes", "Ring capacity", stats.capacity);
+    }
+
+    if (MyFramebuffer.base) 
+      m.Set("tinyw_fb_frames", "Frames presented on the shared framebuffer", std::atomic_ref<uint64_t>(FrameSequence).load());
+    if (MyDamage) {
+      auto stats = MyDamage->GetStats();
+      m.Set("tinyw_fb_damage_bytes", "Pixel bytes delivered through send_damage", stats.bytes);
+      m.Set("tinyw_fb_damage_full_bytes", "Pixel bytes whole frames would have needed", stats.full_bytes);
+    }
+
+    try {
+      m.Write(MetricsPath);
+    } catch (const std::exception &e) {
+      std::cerr << "> [i:warn]: cannot write metrics to " << MetricsPath << ": " << e.what() << std::endl;
+    }
+  }
+
+  // -cpu count <N>: N cores over the same CPU module and guest memory.
+  void SetupSMP(const std::vector<std::string> &args_cpu) {
+    auto count = std::stoul(GetOption(args_cpu, "count", "1"));
+    if (count == 0 || count > 4096) therr(func, "`-cpu count` must be between 1 and 4096");
+    MySMP = tinyw_smp{ .core_count = (uint32_t)count, .atomics = host_atomics() };
+  }
+
+  static uint32_t ParseFramebufferFormat(const std::string &format, uint32_t &bytes_per_pixel) {
+    auto f = to_lowercase(format);
+    if (f == "rgba8888") { bytes_per_pixel = 4; return TINYW_FB_FORMAT_RGBA8888; }
+    if (f == "bgra8888") { bytes_per_pixel = 4; return TINYW_FB_FORMAT_BGRA8888; }
+    if (f == "rgb565")   { bytes_per_pixel = 2; return TINYW_FB_FORMAT_RGB565; }
+    if (f == "index8")   { bytes_per_pixel = 1; return TINYW_FB_FORMAT_INDEX8; }
+    therr(func, "Unknown framebuffer format: `" + format + "`");
+    return 0;
+  }
+
+  // -gpu fb <guest address> -gpu fb-size <W>x<H> [-gpu fb-format rgba8888] [-gpu fb-stride <bytes>]
+  // The GPU then reads pixels straight out of guest memory; the window must 
+  // lie inside one writable region of the memory map.
+  // [-gpu fb-damage <off|on|marked|compare>] [-gpu fb-tile <pixels>] 
+  // [-gpu fb-damage-poll <duration>]: the GPU gets the changed rectangles 
+  // of each presented frame through `send_damage` (see damage.hpp).
+  const tinyw_framebuffer *SetupFramebuffer(const std::vector<std::string> &args_gpu) {
+    auto address = GetOption(args_gpu, "fb");
+    if (address.empty()) return nullptr;
+
+    auto size = to_lowercase(GetOption(args_gpu, "fb-size"));
+    auto x = size.find('x');
+    if (x == std::string::npos) therr(func, "`-gpu fb` requires `-gpu fb-size <width>x<height>`");
+
+    uint32_t bytes_per_pixel = 0;
+    MyFramebuffer.guest_addr = std::stoull(address, nullptr, 0);
+    MyFramebuffer.width = std::stoul(size.substr(0, x));
+    MyFramebuffer.height = std::stoul(size.substr(x + 1));
+    MyFramebuffer.format = ParseFramebufferFormat(GetOption(args_gpu, "fb-format", "rgba8888"), bytes_per_pixel);
+    MyFramebuffer.stride = std::stoul(GetOption(args_gpu, "fb-stride", std::to_string(MyFramebuffer.width * bytes_per_pixel)), nullptr, 0);
+    if (MyFramebuffer.stride < MyFramebuffer.width * bytes_per_pixel) therr(func, "Framebuffer stride is smaller than a row");
+
+    const uint64_t bytes = uint64_t(MyFramebuffer.stride) * MyFramebuffer.height;
+    const auto *map = MyMemory.GetMap();
+    for (uint32_t i = 0; map && i < map->count; i++) {
+      const auto &region = map->regions[i];
+      if (MyFramebuffer.guest_addr < region.guest_addr) continue;
+      if (MyFramebuffer.guest_addr - region.guest_addr + bytes > region.size) continue;
+      if (!(region.flags & TINYW_REGION_WRITE) || (region.flags & TINYW_REGION_MMIO)) continue;
+
+      MyFramebuffer.base = region.base + (MyFramebuffer.guest_addr - region.guest_addr);
+      MyFramebuffer.sequence = &FrameSequence;
+
+      auto damage = to_lowercase(GetOption(args_gpu, "fb-damage", "off"));
+      if (damage != "off") {
+        MyDamage = std::make_unique<FramebufferDamage>(MyFramebuffer, bytes_per_pixel, 
+          std::stoul(GetOption(args_gpu, "fb-tile", "16")), FramebufferDamage::ParseMode(damage));
+        DamagePoll = parse_duration(GetOption(args_gpu, "fb-damage-poll", "1ms"));
+      }
+      return &MyFramebuffer;
+    }
+
+    therr(func, AnyString("Framebuffer [") | MyFramebuffer.guest_addr | ", +" | bytes | ") is not inside a writable memory region");
+    return nullptr;
+  }
 
   void Open(const fs::path &cpu, const fs::path &gpu, const fs::path &memory, 
+            const std::vector<std::string> &args_core, 
             const std::vector<std::string> &args_cpu, const std::vector<std::string> &args_gpu, 
             const std::vector<std::string> &args_mem) {
     auto task = GenericTask("init core", [&](auto progress_report){
       decl_scope {
+        TraceSpan span("core: test modules");
         std::stack<std::string> errors{};
         auto TestCPU = DynamicLibrary::TestLib(cpu);
         progress_report(0.1f);
@@ -55,18 +440,58 @@ private:
       };
 
       progress_report(0.4f);
-      MyMemory.init(memory, args_mem);
+      SetupHostServices(args_core);
+      decl_scope {
+        TraceSpan span("core: guest memory");
+        AllocateGuestRAM(args_mem);
+        CPUPlacement = ParsePlacement(args_core, "cpu");
+        GPUPlacement = ParsePlacement(args_core, "gpu");
+        BindGuestRAM(args_core);
+      };
+      decl_scope {
+        TraceSpan span("core: memory init");
+        MyMemory.init(memory, args_mem, &MyRAM, { .stop = MyStop.Token(), .tracer = tracer().ABI(), 
+                                           .host = MemoryHost.Table() });
+        MemoryHost.ThrowIfFailed();
+      };
 
       progress_report(0.7f);
-      MyGPU.init(gpu, args_gpu);
+      const tinyw_framebuffer *framebuffer = nullptr;
+      decl_scope {
+        TraceSpan span("core: gpu init");
+        framebuffer = SetupFramebuffer(args_gpu);
+        MyGPU.init(gpu, args_gpu, { .framebuffer = framebuffer, .stop = MyStop.Token(), .tracer = tracer().ABI(), 
+                                    .host = GPUHost.Table() });
+        GPUHost.ThrowIfFailed();
+        if (MyDamage && !MyGPU.can_send_damage()) 
+          therr(func, "`-gpu fb-damage` was requested, but " + gpu.string() + " does not take damage lists (`send_damage`)");
+      };
 
       progress_report(0.85f);
-      MyCPU.init(cpu, MyMemory.get_EGetPointer(), MyMemory.get_EGetSize(), args_cpu);
+      decl_scope {
+        TraceSpan span("core: cpu init");
+        SetupSMP(args_cpu);
+        CreateRing(args_core);
+        MyCPU.init(cpu, MyMemory.GetMap(), MyMemory.get_EGetPointer(), MyMemory.get_EGetSize(), args_cpu, 
+                   { .gpu_queue = &MyQueue, .framebuffer = framebuffer, .stop = MyStop.Token(), .smp = &MySMP, 
+                     .tracer = tracer().ABI(), .host = CPUHost.Table() });
+        CPUHost.ThrowIfFailed();
+        if (!MyCPU.uses_gpu_queue()) MyRing.reset();
+        SetupScheduler(args_core);
+      };
 
       progress_report(1.0f);
     });
 
     run_task_with_ui(task);
+    if (task_timings_report()) print_task_timings(std::cerr);
+
+    if (MyRAM.Data()) {
+      task_out() << "> guest memory: " << format_size(MyRAM.Size()) << ", " 
+                 << format_size(MyRAM.PageSize()) << " pages (" << MyRAM.Backing() << ")" << std::endl;
+    }
+
+    if (MySMP.core_count > 1) task_out() << "> smp: " << MySMP.core_count << " cpu cores" << std::endl;
   }
 
   void HandleArguments(const std::vector<std::string> &core_args, 
@@ -105,21 +530,28 @@ private:
       }
     }
 
-    if (!fs::exists(cpu)) {
+    // Statically linked modules win over the libraries on disk.
+    for (auto *file : { &cpu, &gpu, &mem }) {
+      auto linked = prefer_static_module(*file);
+      if (linked != *file) task_out() << "> " << file->string() << ": using the statically linked " << linked.string() << std::endl;
+      *file = linked;
+    }
+
+    if (!is_builtin_module(cpu) && !fs::exists(cpu)) {
       fs::path cpu_with_ext = cpu;
       cpu_with_ext += LIB_EXTENTION;
       if (!fs::exists(cpu_with_ext))
       therr(func, "CPU file: " + cpu.string() + " or " + cpu_with_ext.string() + " not found\nCannot continue..");
       cpu = cpu_with_ext;
     }
-    if (!fs::exists(gpu)) {
+    if (!is_builtin_module(gpu) && !fs::exists(gpu)) {
       fs::path gpu_with_ext = gpu;
       gpu_with_ext += LIB_EXTENTION;
       if (!fs::exists(gpu_with_ext))
       therr(func, "GPU file: " + gpu.string() + " or " + gpu_with_ext.string() + " not found\nCannot continue..");
       gpu = gpu_with_ext;
     }
-    if (!fs::exists(mem)) {
+    if (!is_builtin_module(mem) && !fs::exists(mem)) {
       fs::path mem_with_ext = mem;
       mem_with_ext += LIB_EXTENTION;
       if (!fs::exists(mem_with_ext))
@@ -127,45 +559,207 @@ private:
       mem = mem_with_ext;
     }
     
-    Open(cpu, gpu, mem, cpu_args, gpu_args, mem_args);
+    CoreArgs = core_args;
+    ModuleFiles = { cpu, gpu, mem };
+    Open(cpu, gpu, mem, core_args, cpu_args, gpu_args, mem_args);
   }
 
-  void Start() {
-    std::exception_ptr cpu_exc = nullptr;
+  // -core timeout <duration>, -core cpu-limit <duration>, -core stop-grace <duration>
+  void StartWatchdog() {
+    auto timeout = parse_duration(GetOption(CoreArgs, "timeout", "0"));
+    auto cpu_limit = parse_duration(GetOption(CoreArgs, "cpu-limit", "0"));
+    auto grace = parse_duration(GetOption(CoreArgs, "stop-grace", "2s"));
+
+    MyWatchdog.Start(timeout, cpu_limit, grace, [this](const std::string &what) {
+      std::cerr << "\n> [i:warn]: " << what << " reached, stopping VM" << std::endl;
+      RequestStop();
+    });
+  }
+
+  void RequestStop() {
+    MyStop.RequestStop();
+    if (MyRing) MyRing->Close();
+  }
+
+  // CPU core(s), GPU and ring drain each run free on their own thread. 
+  // Errors are appended in the order they get rethrown.
+  void RunThreaded(std::vector<std::exception_ptr> &errors) {
+    const uint32_t cores = std::max<uint32_t>(1, MySMP.core_count);
+    std::vector<std::exception_ptr> cpu_exc(cores);
     std::exception_ptr gpu_exc = nullptr;
+    std::exception_ptr ring_exc = nullptr;
+
+    if (MySnapshot && SnapshotInterval.count()) MySnapshot->StartPeriodic(SnapshotInterval);
+
+    // Every thread applies its placement first; the result is reported 
+    // once all of them did.
+    const bool report_placement = !CPUPlacement.Empty() || !GPUPlacement.Empty();
+    std::vector<std::string> placements(cores + 3);
+    std::latch placed(cores + 1 + (MyRing ? 1 : 0) + (MyDamage ? 1 : 0));
+    auto place = [&](size_t slot, const ThreadPlacement &placement) {
+      if (report_placement || !placement.Empty()) placements[slot] = apply_thread_placement(placement);
+      placed.count_down();
+    };
 
-    std::thread cpu_thread([&] {
+    // One thread per core. A failing core stops the others; otherwise the
+    // last one out stops the GPU and the ring drain, as there is nothing 
+    // left to run.
+    std::atomic<uint32_t> running{cores};
+    std::vector<std::thread> cpu_threads;
+    cpu_threads.reserve(cores);
+    for (uint32_t id = 0; id < cores; id++) cpu_threads.emplace_back([&, id] {
+      place(id, CorePlacement(id, cores));
+      tracer().NameThread(cores > 1 ? "cpu" + std::to_string(id) : "cpu");
       try {
-        MyCPU.start();
-        should_stop.load();
-        MyCPU.stop();
+        if (cores > 1) {
+          RunMetrics::Labels core = { { "core", std::to_string(id) } };
+          MarkRunBegan();
+          Timed("start", "cpu", [&] { MyCPU.start_core(id); }, core);
+          MarkRunEnded();
+          Timed("stop", "cpu", [&] { MyCPU.stop_core(id); }, core);
+        } else {
+          MarkRunBegan();
+          Timed("start", "cpu", [&] { MyCPU.start(); });
+          MarkRunEnded();
+          Timed("stop", "cpu", [&] { MyCPU.stop(); });
+        }
       } catch (...) {
-        cpu_exc = std::current_exception();
-        should_stop = true; 
+        cpu_exc[id] = std::current_exception();
+        RequestStop();
+      }
+      if (running.fetch_sub(1) == 1) RequestStop();
+    });
+
+    // Feeds `send_bytes` from the CPU command ring until the CPU is done 
+    // and everything it pushed has been delivered.
+    std::thread ring_thread;
+    if (MyRing) ring_thread = std::thread([&] {
+      place(cores + 1, GPUPlacement);
+      tracer().NameThread("ring drain");
+      try {
+        while (MyRing->WaitForData()) {
+          MyRing->Drain([&](uint8_t *bytes, uint64_t len) { SendBytes(bytes, len); }, RingBatch);
+        }
+      } catch (...) {
+        ring_exc = std::current_exception();
+        RequestStop();
+      }
+    });
+
+    // Polls for presented frames and delivers their damage, then flushes 
+    // the last one once the CPU is done.
+    std::exception_ptr damage_exc = nullptr;
+    std::thread damage_thread;
+    if (MyDamage) damage_thread = std::thread([&] {
+      place(cores + 2, GPUPlacement);
+      tracer().NameThread("fb damage");
+      try {
+        while (!MyStop.StopRequested()) {
+          if (!DeliverDamage()) std::this_thread::sleep_for(DamagePoll);
+        }
+        DeliverDamage();
+      } catch (...) {
+        damage_exc = std::current_exception();
+        RequestStop();
       }
     });
 
     std::thread gpu_thread([&] {
+      place(cores, GPUPlacement);
+      tracer().NameThread("gpu");
       try {
-        MyGPU.start();
+        Timed("start", "gpu", [&] { MyGPU.start(); });
         // GPU can't ask for shutting down
-        MyGPU.stop();
+        Timed("stop", "gpu", [&] { MyGPU.stop(); });
       } catch (...) {
         gpu_exc = std::current_exception();
-        should_stop = true; 
+        RequestStop();
       }
     });
 
-    cpu_thread.join();
+    placed.wait();
+    if (report_placement) {
+      for (uint32_t id = 0; id < cores; id++) 
+        task_out() << "> placement: cpu" << (cores > 1 ? std::to_string(id) : "") << ": " << placements[id] << std::endl;
+      task_out() << "> placement: gpu: " << placements[cores] << std::endl;
+      if (MyRing) task_out() << "> placement: ring: " << placements[cores + 1] << std::endl;
+      if (MyDamage) task_out() << "> placement: damage: " << placements[cores + 2] << std::endl;
+    }
+
+    for (auto &thread : cpu_threads) thread.join();
+    if (ring_thread.joinable()) ring_thread.join();
+    if (damage_thread.joinable()) damage_thread.join();
     gpu_thread.join();
-    MyMemory.clear();
 
-    if (cpu_exc) std::rethrow_exception(cpu_exc);
-    if (gpu_exc) std::rethrow_exception(gpu_exc);
+    if (MySnapshot) MySnapshot->StopPeriodic();
+    errors.insert(errors.end(), cpu_exc.begin(), cpu_exc.end());
+    errors.push_back(ring_exc);
+    errors.push_back(damage_exc);
+    errors.push_back(gpu_exc);
+  }
+
+  // -core sched lockstep [-core quantum <cycles>]: the CPU and GPU take 
+  // turns on one thread, `Quantum` cycles at a time, and the commands of 
+  // each CPU step are delivered before the GPU steps. Runs are reproducible 
+  // and the ring stays hot in one core's cache.
+  void RunLockstep(std::vector<std::exception_ptr> &errors) {
+    std::exception_ptr exc = nullptr;
+    uint64_t quanta = 0, cycles = 0;
+
+    std::thread thread([&] {
+      auto placement = apply_thread_placement(CPUPlacement);
+      tracer().NameThread("lockstep");
+      if (!CPUPlacement.Empty() || !GPUPlacement.Empty()) task_out() << "> placement: lockstep: " << placement << std::endl;
+
+      try {
+        MarkRunBegan();
+        for (;;) {
+          uint64_t used = RunFor(Quantum);
+          quanta++;
+          if (used == TINYW_STEP_HALTED) break;
+          cycles += used;
+          if (MySnapshot && SnapshotEvery && quanta % SnapshotEvery == 0) MySnapshot->Checkpoint();
+        }
+        MarkRunEnded();
+        StopModules();
+      } catch (...) {
+        exc = std::current_exception();
+      }
+      RequestStop();
+    });
+    thread.join();
+
+    task_out() << "> lockstep: " << quanta << " quanta of " << Quantum << ", " << cycles << " cpu cycles" << std::endl;
+    errors.push_back(exc);
+  }
+
+  void MarkRunBegan() {
+    int64_t none = 0;
+    RunBegan.compare_exchange_strong(none, std::chrono::steady_clock::now().time_since_epoch().count());
+  }
+
+  void MarkRunEnded() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+    for (auto last = RunEnded.load(); last < now && !RunEnded.compare_exchange_weak(last, now);) {}
+  }
+
+  void StopModules() {
+    Deliver();
+    DeliverDamage();
+    Timed("stop", "cpu", [&] { MyCPU.stop(); });
+    Timed("stop", "gpu", [&] { MyGPU.stop(); });
+  }
+
+  void ReleaseResources() {
+    FinishSnapshots();
+    Timed("clear", "memory", [&] { MyMemory.clear(); });
+    MyImage.Unmap();
+    MyRAM.Free();
   }
 
 public:
-  void Run(const std::vector<std::string> &args) {
+  // Parses `run` arguments, opens the modules and loads the program image.
+  void Load(const std::vector<std::string> &args) {
     std::vector<std::string> core_args; // Prefix: -core:$ARG
     std::vector<std::string> cpu_args;  // Prefix: -cpu:$ARG
     std::vector<std::string> gpu_args;  // Prefix: -gpu:$ARG
@@ -201,12 +795,122 @@ public:
     exec_file = fs::absolute(exec_file);
 
     try_x(
+      SetupTrace(core_args);
+      SetupMetrics(core_args);
       HandleArguments(core_args, cpu_args, gpu_args, mem_args);
+      LoadImage(exec_file, core_args);
+      SetupSnapshots(core_args);
     );
+    Loaded = std::chrono::steady_clock::now();
+  }
+
+  // Runs a loaded VM to completion, as configured by its `-core` options.
+  void Start() {
+    StartWatchdog();
+
+    std::vector<std::exception_ptr> errors;
+    if (Lockstep) RunLockstep(errors);
+    else RunThreaded(errors);
+
+    MyWatchdog.Finish();
+    ReleaseResources();
+
+    if (MyRing) {
+      auto stats = MyRing->GetStats();
+      task_out() << "> gpu ring: " << stats.pushed << " records (" << stats.pushed_bytes << " bytes) in " 
+                 << stats.batches << " batches, " << stats.dropped << " dropped, " << stats.overwritten 
+                 << " overwritten, high-water " << stats.high_water << "/" << stats.capacity << " bytes" << std::endl;
+    }
+
+    if (MyFramebuffer.base) {
+      task_out() << "> framebuffer: " << std::atomic_ref<uint64_t>(FrameSequence).load() << " frames presented" << std::endl;
+    }
+
+    if (MyDamage) {
+      auto stats = MyDamage->GetStats();
+      task_out() << "> fb damage: " << stats.frames << " frames, " << stats.rects << " rects, " << stats.bytes 
+                 << " of " << stats.full_bytes << " bytes sent (" << std::fixed << std::setprecision(1) 
+                 << (stats.full_bytes ? 100.0 * stats.bytes / stats.full_bytes : 0.0) << "%), " 
+                 << stats.compared << " tiles compared" << std::endl;
+      task_out().unsetf(std::ios::floatfield);
+    }
+
+    WriteMetrics();
+
+    for (auto &exc : errors) if (exc) std::rethrow_exception(exc);
+    ThrowIfModuleFailed();
+    if (!MyWatchdog.Expired().empty()) therr(func, "VM stopped by the " + MyWatchdog.Expired());
+  }
 
+  void Run(const std::vector<std::string> &args) {
+    Load(args);
     Start();
   }
 
+  // Bounds of the guest run as seen from the host, in steady_clock ticks; 
+  // 0 until the CPU got there.
+  int64_t GetRunBegan() const { return RunBegan.load(); }
+  int64_t GetRunEnded() const { return RunEnded.load(); }
+
+  // External scheduling: once loaded, the VM is advanced `RunFor` calls at 
+  // a time by the caller (see sched.hpp) instead of by `Start`.
+  bool CanRunFor() const { return MyCPU.can_step() && MyGPU.can_step() && MySMP.core_count <= 1; }
+
+  void EnterLockstep() {
+    if (!CanRunFor()) therr(func, "Stepping needs `step` in both the CPU and GPU modules and a single CPU core");
+    Lockstep = true;
+    if (MyRing) MyRing->SetDrainWhenFull([this] { Deliver(); });
+  }
+
+  // Runs one quantum: a CPU step of at most `cycles`, delivery of the 
+  // commands it queued, then a GPU step. Returns the cycles used, or 
+  // TINYW_STEP_HALTED once the CPU is done or a stop was requested.
+  uint64_t RunFor(uint64_t cycles) {
+    if (MyStop.StopRequested()) return TINYW_STEP_HALTED;
+    TraceSpan span("quantum", cycles);
+    if (MyMetrics) return TimedRunFor(cycles);
+    uint64_t used = MyCPU.step(cycles);
+    Deliver();
+    DeliverDamage();
+    if (GPURunning && MyGPU.step(cycles) == TINYW_STEP_HALTED) GPURunning = false;
+    return used;
+  }
+
+  // Ends an externally scheduled run.
+  void Shutdown() {
+    std::exception_ptr exc = nullptr;
+    try {
+      StopModules();
+    } catch (...) {
+      exc = std::current_exception();
+    }
+    RequestStop();
+    ReleaseResources();
+    WriteMetrics();
+    if (exc) std::rethrow_exception(exc);
+    ThrowIfModuleFailed();
+  }
+
+  // Module files the `run` arguments `args` would load that a VM cannot 
+  // share with another one: those of plain modules, whose state lives in 
+  // library globals. Instance modules are loaded once and give every VM 
+  // its own handle. Only probes the libraries, so this can be checked 
+  // before `Load` runs any module's `init`.
+  static std::vector<fs::path> GetExclusiveModuleFiles(const std::vector<std::string> &args) {
+    std::vector<fs::path> files;
+    for (size_t i = 0; i + 2 < args.size(); i++) {
+      auto arg = to_lowercase(args[i]);
+      if (arg != "-core" && arg != "-cpu" && arg != "-gpu" && arg != "-mem") continue;
+      if (arg != "-core" && args[i + 1] == "file") {
+        fs::path file = prefer_static_module(args[i + 2]);
+        if (!is_builtin_module(file) && !fs::exists(file)) file += LIB_EXTENTION;
+        if (!ModuleInstance::IsInstanceLibrary(file)) files.push_back(file);
+      }
+      i += 2;
+    }
+    return files;
+  }
+
 };
 
 TinyWDeclEnd
\ No newline at end of file
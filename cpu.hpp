@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <vector>
 #include <memory>
 #include <string>
@@ -18,53 +19,124 @@
 
 TinyWDeclStart
 
+// Guest atomics for SMP modules. Operations are sequentially consistent so 
+// that any guest memory model maps onto them.
+inline const tinyw_atomics *host_atomics() {
+  static const tinyw_atomics atomics = {
+    .load32 = [](const uint32_t *a) { return std::atomic_ref<uint32_t>(*const_cast<uint32_t*>(a)).load(); },
+    .store32 = [](uint32_t *a, uint32_t v) { std::atomic_ref<uint32_t>(*a).store(v); },
+    .exchange32 = [](uint32_t *a, uint32_t v) { return std::atomic_ref<uint32_t>(*a).exchange(v); },
+    .cas32 = [](uint32_t *a, uint32_t *e, uint32_t d) -> int32_t { return std::atomic_ref<uint32_t>(*a).compare_exchange_strong(*e, d); },
+    .fetch_add32 = [](uint32_t *a, uint32_t v) { return std::atomic_ref<uint32_t>(*a).fetch_add(v); },
+    .load64 = [](const uint64_t *a) { return std::atomic_ref<uint64_t>(*const_cast<uint64_t*>(a)).load(); },
+    .store64 = [](uint64_t *a, uint64_t v) { std::atomic_ref<uint64_t>(*a).store(v); },
+    .exchange64 = [](uint64_t *a, uint64_t v) { return std::atomic_ref<uint64_t>(*a).exchange(v); },
+    .cas64 = [](uint64_t *a, uint64_t *e, uint64_t d) -> int32_t { return std::atomic_ref<uint64_t>(*a).compare_exchange_strong(*e, d); },
+    .fetch_add64 = [](uint64_t *a, uint64_t v) { return std::atomic_ref<uint64_t>(*a).fetch_add(v); },
+    .fence = [] { std::atomic_thread_fence(std::memory_order_seq_cst); },
+  };
+  return &atomics;
+}
+
 class CPU {
 private:
-  DynamicLibrary lib;
-  Tfunc_CPUStart EStart;
-  Tfunc_SignVoid EStop;
+  ModuleInstance lib;
+  ModuleEntry<Tfunc_CPUStart> EStart;
+  ModuleEntry<Tfunc_SignVoid> EStop;
+  ModuleEntry<Tfunc_Step> EStep;
+  ModuleEntry<Tfunc_CPUCore> EStartCore;
+  ModuleEntry<Tfunc_CPUCore> EStopCore;
+  bool GPUQueueAttached = false;
+  ModuleTimings Timings;
 
 public:
   void start() {
     EStart();
   }
 
+  // SMP: one call per core, each from its own thread.
+  void start_core(uint32_t core_id) { EStartCore(core_id); }
+  void stop_core(uint32_t core_id) { EStopCore(core_id); }
+
+  // v2 and instance modules get the region table, v1 modules the accessors.
   void init(const fs::path &file, 
+    const tinyw_mem_map *Map,
     Tfunc_MemoryGetPointer GetPointer, 
     Tfunc_MemoryGetSize GetSize, 
-    const std::vector<std::string> &argv) {
-    if (!lib.Open(file)) {
+    const std::vector<std::string> &argv,
+    const ModuleAttachments &Attachments = {}) {
+    auto opening = std::chrono::steady_clock::now();
+    bool opened = lib.Open(file);
+    Timings.open = std::chrono::steady_clock::now() - opening;
+    if (!opened) {
       std::cerr << "\n> Cannot open " << file << std::endl;
       std::cerr << "> [i:err]: " << lib.Error() << std::endl;
       return;
     }
 
-    EStart = (Tfunc_CPUStart)lib.GetSymbol("start");
-    EStop  = (Tfunc_SignVoid)lib.GetSymbol("stop");
-    auto Einit = (Tfunc_CPUInit)lib.GetSymbol("init");
+    ModuleEntry<Tfunc_CPUInit> Einit;
+    ModuleEntry<Tfunc_CPUInitV2> EinitV2;
+    EStart.Bind(lib, "start");
+    EStop.Bind(lib, "stop");
+    Einit.Bind(lib, "init", "");
+    EinitV2.Bind(lib, "init_v2", "init_i");
 
-    if (!EStart || !Einit || !EStop) {
+    if (!EStart || (!Einit && !EinitV2) || !EStop) {
       std::stringstream errmsg;
-      errmsg << "Failed to load required symbols from " << file << "\n"
+      errmsg << "Failed to load required symbols from " << file << (lib.IsInstance() ? " (instance module)" : "") << "\n"
       "handles:\n"
-      "* EStart:\t" << is_true(EStart == nullptr) << "\n"
-      "* Einit:\t" << is_true(Einit == nullptr) << "\n";
+      "* EStart:\t" << is_true(!EStart) << "\n"
+      "* Einit:\t" << is_true(!Einit) << "\n"
+      "* EinitV2:\t" << is_true(!EinitV2) << "\n";
       therr(func, errmsg.str());
     }
 
+    if (!EinitV2 && (!GetPointer || !GetSize)) 
+      therr(func, file.string() + " is a v1 CPU module, which needs a v1 or v2 memory module (not an instance one)");
+
+    if (Attachments.smp && Attachments.smp->core_count > 1) {
+      EStartCore.Bind(lib, "start_core");
+      EStopCore.Bind(lib, "stop_core");
+      if (!EStartCore || !EStopCore || !lib.Attach("attach_smp", TINYW_ATTACH_SMP, Attachments.smp)) 
+        therr(func, AnyString("`-cpu count ") | Attachments.smp->core_count | "` requires an SMP module, but " | 
+                    file.string() | " does not export `start_core`, `stop_core` and `attach_smp`");
+    }
+
+    EStep.Bind(lib, "step");
+    lib.Attach("attach_host", TINYW_ATTACH_HOST, Attachments.host);
+    lib.Attach("attach_stop_token", TINYW_ATTACH_STOP_TOKEN, Attachments.stop);
+    lib.Attach("attach_tracer", TINYW_ATTACH_TRACER, Attachments.tracer);
+    GPUQueueAttached = lib.Attach("attach_gpu_queue", TINYW_ATTACH_GPU_QUEUE, Attachments.gpu_queue);
+    lib.Attach("attach_framebuffer", TINYW_ATTACH_FRAMEBUFFER, Attachments.framebuffer);
+
     std::vector<char*> cstr_argv;
     cstr_argv.reserve(argv.size());
     for (const auto& arg : argv) {
       cstr_argv.push_back(cstrdup(arg.c_str())); 
     }
 
-    Einit(GetPointer, GetSize, cstr_argv.size(), cstr_argv.data());
+    auto initializing = std::chrono::steady_clock::now();
+    if (EinitV2) EinitV2(Map, cstr_argv.size(), cstr_argv.data());
+    else Einit(GetPointer, GetSize, cstr_argv.size(), cstr_argv.data());
+    Timings.init = std::chrono::steady_clock::now() - initializing;
 
     for (auto ptr : cstr_argv) {
       free(ptr);
     }
   }
 
+  // Whether the module took the host command queue to the GPU.
+  bool uses_gpu_queue() const { return GPUQueueAttached; }
+
+  // Lockstep scheduling, when the module exports `step`.
+  bool can_step() const { return bool(EStep); }
+  uint64_t step(uint64_t budget) { return EStep(budget); }
+
+  // Instance modules can back any number of VMs from one loaded library.
+  bool is_instance() const { return lib.IsInstance(); }
+
+  const ModuleTimings &get_timings() const { return Timings; }
+
   void stop() { return EStop(); }
 };
 
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "glob.hpp"
+
+TinyWDeclStart
+
+// Turns presented frames into damage lists for the GPU's `send_damage`.
+// The framebuffer is split in square tiles with one bit each: the CPU sets
+// bits with `tinyw_fb_damage`, and for CPUs that do not, tiles are compared
+// against a shadow copy of what was last delivered. Dirty tiles are merged
+// into rectangles and only their pixels are copied out.
+class FramebufferDamage {
+public:
+  // Marked: trust `tinyw_fb_damage` only. Compare: always compare against
+  // the shadow. Auto: compare until the CPU marks its first tile.
+  enum class Mode { Marked, Compare, Auto };
+
+  struct Stats {
+    uint64_t frames = 0;        // deliveries, a frame presented twice before one counts once
+    uint64_t rects = 0;
+    uint64_t bytes = 0;         // pixel bytes delivered
+    uint64_t full_bytes = 0;    // what sending every frame whole would have cost
+    uint64_t compared = 0;      // tiles compared against the shadow
+  };
+
+  static Mode ParseMode(const std::string &mode) {
+    auto m = to_lowercase(mode);
+    if (m == "on" || m == "auto") return Mode::Auto;
+    if (m == "marked") return Mode::Marked;
+    if (m == "compare") return Mode::Compare;
+    therr(func, "Unknown damage mode: `" + mode + "` (expected off, on, marked or compare)");
+    return Mode::Auto;
+  }
+
+private:
+  struct Run { uint32_t first, last, top; };  // tile columns [first, last], open since tile row `top`
+
+  tinyw_framebuffer &fb_;
+  uint32_t bpp_;
+  uint32_t tile_;
+  uint32_t tiles_x_, tiles_y_;
+  Mode mode_;
+  bool marked_ = false;       // the CPU marked at least one tile
+  bool first_ = true;         // the GPU has not seen anything yet
+  uint64_t delivered_ = 0;    // last sequence delivered
+
+  std::unique_ptr<uint64_t[]> bits_;
+  std::vector<uint64_t> dirty_;
+  std::vector<uint8_t> shadow_;    // packed rows, width * bpp bytes each
+  std::vector<tinyw_fb_rect> rects_;
+  std::vector<uint8_t> pixels_;
+  Stats stats_;
+
+  uint64_t Words() const { return (uint64_t(tiles_x_) * tiles_y_ + 63) / 64; }
+
+  bool IsDirty(uint64_t tile) const { return dirty_[tile / 64] >> (tile % 64) & 1; }
+
+  uint32_t TileWidth(uint32_t tx) const { return std::min(tile_, fb_.width - tx * tile_); }
+  uint32_t TileHeight(uint32_t ty) const { return std::min(tile_, fb_.height - ty * tile_); }
+
+  bool TileChanged(uint32_t tx, uint32_t ty) const {
+    const uint64_t row = uint64_t(fb_.width) * bpp_;
+    const uint64_t x = uint64_t(tx) * tile_ * bpp_, bytes = uint64_t(TileWidth(tx)) * bpp_;
+    for (uint32_t y = ty * tile_, end = y + TileHeight(ty); y < end; y++) {
+      if (std::memcmp(fb_.base + uint64_t(y) * fb_.stride + x, shadow_.data() + y * row + x, bytes) != 0) return true;
+    }
+    return false;
+  }
+
+  void Emit(const Run &run, uint32_t bottom) {
+    tinyw_fb_rect rect{};
+    rect.x = run.first * tile_;
+    rect.y = run.top * tile_;
+    rect.width = std::min(fb_.width, (run.last + 1) * tile_) - rect.x;
+    rect.height = std::min(fb_.height, bottom * tile_) - rect.y;
+    rect.offset = pixels_.size();
+
+    const uint64_t bytes = uint64_t(rect.width) * bpp_, row = uint64_t(fb_.width) * bpp_;
+    pixels_.resize(pixels_.size() + bytes * rect.height);
+    uint8_t *out = pixels_.data() + rect.offset;
+    for (uint32_t y = rect.y; y < rect.y + rect.height; y++, out += bytes) {
+      const uint8_t *in = fb_.base + uint64_t(y) * fb_.stride + uint64_t(rect.x) * bpp_;
+      std::memcpy(out, in, bytes);
+      if (!shadow_.empty()) std::memcpy(shadow_.data() + y * row + uint64_t(rect.x) * bpp_, out, bytes);
+    }
+    rects_.push_back(rect);
+  }
+
+  // Horizontal runs of dirty tiles; a run that lines up exactly with one
+  // of the previous tile row grows that rectangle instead of starting one.
+  void BuildRects() {
+    rects_.clear();
+    pixels_.clear();
+    std::vector<Run> open, next;
+    for (uint32_t ty = 0; ty < tiles_y_; ty++) {
+      next.clear();
+      for (uint32_t tx = 0; tx < tiles_x_; tx++) {
+        if (!IsDirty(uint64_t(ty) * tiles_x_ + tx)) continue;
+        uint32_t last = tx;
+        while (last + 1 < tiles_x_ && IsDirty(uint64_t(ty) * tiles_x_ + last + 1)) last++;
+
+        Run run{ tx, last, ty };
+        for (auto &prev : open) {
+          if (prev.first == tx && prev.last == last) { run.top = prev.top; prev.top = UINT32_MAX; break; }
+        }
+        next.push_back(run);
+        tx = last;
+      }
+      for (const auto &prev : open) if (prev.top != UINT32_MAX) Emit(prev, ty);
+      open.swap(next);
+    }
+    for (const auto &prev : open) Emit(prev, tiles_y_);
+  }
+
+public:
+  // Sets up `fb`'s damage fields; `fb` must outlive this object.
+  FramebufferDamage(tinyw_framebuffer &fb, uint32_t bytes_per_pixel, uint32_t tile_size, Mode mode)
+    : fb_(fb), bpp_(bytes_per_pixel), tile_(tile_size), mode_(mode) {
+    if (tile_ == 0 || tile_ > 4096) therr(func, "Damage tile size must be between 1 and 4096 pixels");
+    tiles_x_ = (fb_.width + tile_ - 1) / tile_;
+    tiles_y_ = (fb_.height + tile_ - 1) / tile_;
+    bits_ = std::make_unique<uint64_t[]>(Words());
+    dirty_.resize(Words());
+    if (mode_ != Mode::Marked) shadow_.resize(uint64_t(fb_.width) * bpp_ * fb_.height);
+
+    fb_.tile_size = tile_;
+    fb_.tiles_x = tiles_x_;
+    fb_.damage = bits_.get();
+  }
+
+  ~FramebufferDamage() {
+    fb_.tile_size = 0;
+    fb_.tiles_x = 0;
+    fb_.damage = nullptr;
+  }
+
+  FramebufferDamage(const FramebufferDamage&) = delete;
+  FramebufferDamage &operator=(const FramebufferDamage&) = delete;
+
+  // If a frame was presented since the last call, hands its damage to
+  // `send` (a `void(const tinyw_fb_damage_list&)`). Returns whether it did.
+  // Only one thread may deliver at a time.
+  template <typename Fn>
+  bool Deliver(Fn &&send) {
+    const uint64_t sequence = std::atomic_ref<uint64_t>(*fb_.sequence).load(std::memory_order_acquire);
+    if (sequence == delivered_) return false;
+
+    // Bits are taken before pixels are copied: a tile redrawn meanwhile is
+    // marked again and goes out with the next frame.
+    bool any = false;
+    for (uint64_t i = 0; i < Words(); i++) {
+      dirty_[i] = std::atomic_ref<uint64_t>(bits_[i]).exchange(0, std::memory_order_acquire);
+      any |= dirty_[i] != 0;
+    }
+    marked_ |= any;
+
+    if (first_) {
+      std::fill(dirty_.begin(), dirty_.end(), ~uint64_t(0));
+      first_ = false;
+    } else if (mode_ == Mode::Compare || (mode_ == Mode::Auto && !marked_)) {
+      for (uint32_t ty = 0; ty < tiles_y_; ty++) {
+        for (uint32_t tx = 0; tx < tiles_x_; tx++) {
+          uint64_t tile = uint64_t(ty) * tiles_x_ + tx;
+          if (IsDirty(tile)) continue;
+          stats_.compared++;
+          if (TileChanged(tx, ty)) dirty_[tile / 64] |= uint64_t(1) << (tile % 64);
+        }
+      }
+    }
+
+    // The tail of the last word has no tiles behind it.
+    const uint64_t tiles = uint64_t(tiles_x_) * tiles_y_;
+    if (tiles % 64) dirty_.back() &= (uint64_t(1) << (tiles % 64)) - 1;
+
+    BuildRects();
+
+    tinyw_fb_damage_list list{};
+    list.sequence = sequence;
+    list.count = (uint32_t)rects_.size();
+    list.bytes_per_pixel = bpp_;
+    list.rects = rects_.data();
+    list.pixels = pixels_.data();
+    list.pixel_bytes = pixels_.size();
+    send(list);
+
+    delivered_ = sequence;
+    stats_.frames++;
+    stats_.rects += rects_.size();
+    stats_.bytes += pixels_.size();
+    stats_.full_bytes += uint64_t(fb_.width) * bpp_ * fb_.height;
+    return true;
+  }
+
+  Stats GetStats() const { return stats_; }
+};
+
+TinyWDeclEnd
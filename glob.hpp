@@ -50,18 +50,173 @@
     } \
 } while(0)
 
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
 #include <filesystem>
 
+// Keep in sync with base/tinyc.h
+#define TINYW_MEM_MAP_VERSION 2
+
+#define TINYW_REGION_READ  0x1u
+#define TINYW_REGION_WRITE 0x2u
+#define TINYW_REGION_EXEC  0x4u
+#define TINYW_REGION_MMIO  0x8u
+#define TINYW_REGION_RO    (TINYW_REGION_READ)
+#define TINYW_REGION_RW    (TINYW_REGION_READ | TINYW_REGION_WRITE)
+
+#define TINYW_FB_FORMAT_RGBA8888 1
+#define TINYW_FB_FORMAT_BGRA8888 2
+#define TINYW_FB_FORMAT_RGB565   3
+#define TINYW_FB_FORMAT_INDEX8   4
+
+#define TINYW_QUEUE_OK      0
+#define TINYW_QUEUE_DROPPED 1
+#define TINYW_QUEUE_CLOSED  2
+
+#define TINYW_STEP_HALTED UINT64_MAX
+
+#define TINYW_ATTACH_STOP_TOKEN  1
+#define TINYW_ATTACH_GPU_QUEUE   2
+#define TINYW_ATTACH_FRAMEBUFFER 3
+#define TINYW_ATTACH_SMP         4
+#define TINYW_ATTACH_TRACER      5
+#define TINYW_ATTACH_HOST        6
+
+#define TINYW_HOST_SERVICES_VERSION 1
+
+#define TINYW_HOST_CAP_LOG   0x01u
+#define TINYW_HOST_CAP_CLOCK 0x02u
+#define TINYW_HOST_CAP_ALLOC 0x04u
+#define TINYW_HOST_CAP_STOP  0x08u
+#define TINYW_HOST_CAP_TRACE 0x10u
+#define TINYW_HOST_CAP_FAIL  0x20u
+
+#define TINYW_LOG_DEBUG 0
+#define TINYW_LOG_INFO  1
+#define TINYW_LOG_WARN  2
+#define TINYW_LOG_ERROR 3
+
+#define TINYW_TRACE_BEGIN   0
+#define TINYW_TRACE_END     1
+#define TINYW_TRACE_INSTANT 2
+#define TINYW_TRACE_COUNTER 3
+
 TinyWDecl(okay(namespace fs = std::filesystem;))
+TinyWDecl(
+  typedef struct tinyw_mem_region {
+    uint8_t *base;
+    uint64_t guest_addr;
+    uint64_t size;
+    uint32_t flags;
+    uint32_t page_size;
+  } tinyw_mem_region;
+
+  typedef struct tinyw_mem_map {
+    uint32_t version;
+    uint32_t count;
+    const tinyw_mem_region *regions;
+  } tinyw_mem_map;
+
+  typedef struct tinyw_framebuffer {
+    uint8_t  *base;
+    uint64_t  guest_addr;
+    uint32_t  width;
+    uint32_t  height;
+    uint32_t  stride;
+    uint32_t  format;
+    uint64_t *sequence;
+    uint32_t  tile_size;
+    uint32_t  tiles_x;
+    uint64_t *damage;
+  } tinyw_framebuffer;
+
+  typedef struct tinyw_fb_rect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset;
+  } tinyw_fb_rect;
+
+  typedef struct tinyw_fb_damage_list {
+    uint64_t sequence;
+    uint32_t count;
+    uint32_t bytes_per_pixel;
+    const tinyw_fb_rect *rects;
+    const uint8_t *pixels;
+    uint64_t pixel_bytes;
+  } tinyw_fb_damage_list;
+
+  typedef struct tinyw_stop_token {
+    const uint32_t *flag;
+    int32_t event_fd;
+  } tinyw_stop_token;
+
+  typedef struct tinyw_gpu_queue {
+    void *ctx;
+    int32_t (*push)(void *ctx, const uint8_t *bytes, uint64_t len);
+  } tinyw_gpu_queue;
+
+  typedef struct tinyw_atomics {
+    uint32_t (*load32)(const uint32_t *addr);
+    void     (*store32)(uint32_t *addr, uint32_t value);
+    uint32_t (*exchange32)(uint32_t *addr, uint32_t value);
+    int32_t  (*cas32)(uint32_t *addr, uint32_t *expected, uint32_t desired);
+    uint32_t (*fetch_add32)(uint32_t *addr, uint32_t value);
+    uint64_t (*load64)(const uint64_t *addr);
+    void     (*store64)(uint64_t *addr, uint64_t value);
+    uint64_t (*exchange64)(uint64_t *addr, uint64_t value);
+    int32_t  (*cas64)(uint64_t *addr, uint64_t *expected, uint64_t desired);
+    uint64_t (*fetch_add64)(uint64_t *addr, uint64_t value);
+    void     (*fence)(void);
+  } tinyw_atomics;
+
+  typedef struct tinyw_smp {
+    uint32_t core_count;
+    const tinyw_atomics *atomics;
+  } tinyw_smp;
+
+  typedef struct tinyw_tracer {
+    const uint32_t *enabled;
+    void (*event)(uint32_t type, const char *name, int64_t value);
+  } tinyw_tracer;
+
+  typedef struct tinyw_host_services {
+    uint32_t version;
+    uint32_t size;
+    uint64_t capabilities;
+    void *ctx;
+    void (*log)(void *ctx, uint32_t level, const char *message);
+    uint64_t (*monotonic_ns)(void);
+    void *(*alloc)(uint64_t size, uint64_t alignment);
+    void (*free)(void *ptr);
+    const tinyw_stop_token *stop;
+    const tinyw_tracer *tracer;
+    void (*fail)(void *ctx, const char *message);
+  } tinyw_host_services;
+)
 TinyWDecl(
   typedef uint8_t*(*Tfunc_MemoryGetPointer)();
   typedef uint64_t(*Tfunc_MemoryGetSize)();
+  typedef void(*Tfunc_MemoryLoadImage)(uint8_t*, uint64_t, uint64_t);
   typedef void(*Tfunc_SignVoid)();
   typedef void(*Tfunc_InitArgv)(uint64_t, char *const[]);
   typedef void(*Tfunc_GPUSendBytes)(uint8_t*, uint64_t);
   typedef void(*Tfunc_GPUStart)();
   typedef void(*Tfunc_CPUStart)();
   typedef void(*Tfunc_CPUInit)(Tfunc_MemoryGetPointer, Tfunc_MemoryGetSize, uint64_t, char *const[]);
+  typedef const tinyw_mem_map*(*Tfunc_MemoryGetMap)();
+  typedef void(*Tfunc_CPUInitV2)(const tinyw_mem_map*, uint64_t, char *const[]);
+  typedef void(*Tfunc_MemoryAttach)(uint8_t*, uint64_t, uint32_t);
+  typedef void(*Tfunc_CPUCore)(uint32_t);
+  typedef uint64_t(*Tfunc_Step)(uint64_t);
+  typedef void(*Tfunc_GPUSendDamage)(const tinyw_fb_damage_list*);
+  typedef void *tinyw_instance;
+  typedef tinyw_instance(*Tfunc_CreateInstance)(void);
+  typedef void(*Tfunc_DestroyInstance)(tinyw_instance);
+  typedef int32_t(*Tfunc_AttachInstance)(tinyw_instance, uint32_t, const void*);
 )
 
 TinyWDecl(
@@ -80,6 +235,78 @@ TinyWDecl(
   }
 )
 
+TinyWDecl(
+  inline uint64_t fnv1a64(const void *data, size_t len, uint64_t hash = 14695981039346656037ull) {
+    auto bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < len; i++) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+)
+
+TinyWDeclStart
+  // "4096", "0x1000", "64K", "2M", "1G": binary units.
+  inline uint64_t parse_size(const std::string &value) {
+    size_t end = 0;
+    uint64_t n = std::stoull(value, &end, 0);
+    auto unit = to_lowercase(value.substr(end));
+    if (unit.empty() || unit == "b") return n;
+    if (unit == "k" || unit == "kb" || unit == "kib") return n << 10;
+    if (unit == "m" || unit == "mb" || unit == "mib") return n << 20;
+    if (unit == "g" || unit == "gb" || unit == "gib") return n << 30;
+    if (unit == "t" || unit == "tb" || unit == "tib") return n << 40;
+    throw std::invalid_argument("Unknown size unit in `" + value + "`");
+  }
+
+  // "250ms", "30s", "5m", "1h"; a bare number is in seconds.
+  inline std::chrono::nanoseconds parse_duration(const std::string &value) {
+    size_t end = 0;
+    double n = std::stod(value, &end);
+    auto unit = to_lowercase(value.substr(end));
+    double scale = 1e9;
+    if (unit == "ns") scale = 1;
+    else if (unit == "us") scale = 1e3;
+    else if (unit == "ms") scale = 1e6;
+    else if (unit.empty() || unit == "s") scale = 1e9;
+    else if (unit == "m" || unit == "min") scale = 60e9;
+    else if (unit == "h") scale = 3600e9;
+    else throw std::invalid_argument("Unknown duration unit in `" + value + "`");
+    return std::chrono::nanoseconds((int64_t)(n * scale));
+  }
+
+  inline std::string format_size(uint64_t bytes) {
+    const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    size_t unit = 0;
+    while (unit + 1 < sizeof(units) / sizeof(*units) && bytes >= 1024 && bytes % 1024 == 0) {
+      bytes /= 1024;
+      unit++;
+    }
+    return std::to_string(bytes) + " " + units[unit];
+  }
+
+  // Contents of a JSON string literal, without the quotes.
+  inline std::string json_escape(const std::string &text) {
+    static const char hex[] = "0123456789abcdef";
+    std::string out;
+    for (char c : text) {
+      if (c == '"' || c == '\\') out += '\\', out += c;
+      else if (c == '\n') out += "\\n";
+      else if ((unsigned char)c < 0x20) out += std::string("\\u00") + hex[(c >> 4) & 0xf] + hex[c & 0xf];
+      else out += c;
+    }
+    return out;
+  }
+TinyWDeclEnd
+
+TinyWDecl(
+  inline bool parse_bool(const std::string &value) {
+    auto v = to_lowercase(value);
+    return v == "true" || v == "1" || v == "on" || v == "yes";
+  }
+)
+
 #include <unordered_set>
 #include <unordered_map>
 #include <stack>
@@ -19,41 +19,59 @@ TinyWDeclStart
 
 class GPU {
 private:
-  DynamicLibrary lib;
-  Tfunc_GPUSendBytes ESendBytes;
-  Tfunc_GPUStart     EStart;
-  Tfunc_SignVoid     EStop;
+  ModuleInstance lib;
+  ModuleEntry<Tfunc_GPUSendBytes> ESendBytes;
+  ModuleEntry<Tfunc_GPUStart>     EStart;
+  ModuleEntry<Tfunc_SignVoid>     EStop;
+  ModuleEntry<Tfunc_Step>         EStep;
+  ModuleEntry<Tfunc_GPUSendDamage> ESendDamage;
+  ModuleTimings Timings;
 
 public:
-  void init(const fs::path &file, const std::vector<std::string> &argv) {
-    if (!lib.Open(file)) {
+  void init(const fs::path &file, const std::vector<std::string> &argv, 
+            const ModuleAttachments &Attachments = {}) {
+    auto opening = std::chrono::steady_clock::now();
+    bool opened = lib.Open(file);
+    Timings.open = std::chrono::steady_clock::now() - opening;
+    if (!opened) {
       std::cerr << "\n> Cannot open " << file << std::endl;
       std::cerr << "> [i:err]: " << lib.Error() << std::endl;
       return;
     }
 
-    ESendBytes = (Tfunc_GPUSendBytes)lib.GetSymbol("send_bytes");
-    EStart     = (Tfunc_GPUStart)lib.GetSymbol("start");
-    EStop      = (Tfunc_SignVoid)lib.GetSymbol("stop");
-    auto Einit = (Tfunc_InitArgv)lib.GetSymbol("init");
+    ModuleEntry<Tfunc_InitArgv> Einit;
+    ESendBytes.Bind(lib, "send_bytes");
+    EStart.Bind(lib, "start");
+    EStop.Bind(lib, "stop");
+    Einit.Bind(lib, "init");
 
     if (!EStart || !ESendBytes || !Einit || !EStop) {
       std::stringstream errmsg;
-      errmsg << "Failed to load required symbols from " << file << "\n"
+      errmsg << "Failed to load required symbols from " << file << (lib.IsInstance() ? " (instance module)" : "") << "\n"
       "handles:\n"
-      "* EStart:\t" << is_true(EStart == nullptr) << "\n"
-      "* ESendBytes:\t" << is_true(ESendBytes == nullptr) << "\n"
-      "* Einit:\t" << is_true(Einit == nullptr) << "\n";
+      "* EStart:\t" << is_true(!EStart) << "\n"
+      "* ESendBytes:\t" << is_true(!ESendBytes) << "\n"
+      "* Einit:\t" << is_true(!Einit) << "\n";
       therr(func, errmsg.str());
     }
 
+    EStep.Bind(lib, "step");
+    ESendDamage.Bind(lib, "send_damage");
+    lib.Attach("attach_host", TINYW_ATTACH_HOST, Attachments.host);
+    lib.Attach("attach_stop_token", TINYW_ATTACH_STOP_TOKEN, Attachments.stop);
+    lib.Attach("attach_tracer", TINYW_ATTACH_TRACER, Attachments.tracer);
+    if (Attachments.framebuffer && !lib.Attach("attach_framebuffer", TINYW_ATTACH_FRAMEBUFFER, Attachments.framebuffer)) 
+      therr(func, "A framebuffer was configured, but " + file.string() + " does not take it (`attach_framebuffer`)");
+
     std::vector<char*> cstr_argv;
     cstr_argv.reserve(argv.size());
     for (const auto& arg : argv) {
       cstr_argv.push_back(cstrdup(arg.c_str()));
     }
 
+    auto initializing = std::chrono::steady_clock::now();
     Einit(cstr_argv.size(), cstr_argv.data());
+    Timings.init = std::chrono::steady_clock::now() - initializing;
 
     for (auto ptr : cstr_argv) {
       free(ptr);
@@ -65,6 +83,20 @@ public:
   }
 
   void start() { EStart(); }
+
+  // Damage lists of the shared framebuffer (`-gpu fb-damage`).
+  bool can_send_damage() const { return bool(ESendDamage); }
+  void send_damage(const tinyw_fb_damage_list &damage) { ESendDamage(&damage); }
+
+  // Lockstep scheduling, when the module exports `step`.
+  bool can_step() const { return bool(EStep); }
+  uint64_t step(uint64_t budget) { return EStep(budget); }
+
+  // Instance modules can back any number of VMs from one loaded library.
+  bool is_instance() const { return lib.IsInstance(); }
+
+  const ModuleTimings &get_timings() const { return Timings; }
+
   void stop() { EStop(); }
 };
 
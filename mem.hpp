@@ -4,12 +4,20 @@
 #include <memory>
 #include <string>
 #include <cstdlib>
+#include <cstring>
 #include <sstream>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
 
+#if !defined(_WIN32)
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
 #include "glob.hpp"
 #include "tasks.hpp"
 #include "vec.hpp"
@@ -17,56 +25,362 @@
 
 TinyWDeclStart
 
+// Guest RAM owned by the host, so it can be backed by huge pages: hugetlbfs 
+// first, then transparent huge pages, then regular pages.
+class GuestRAM {
+private:
+  uint8_t *data_ = nullptr;
+  uint64_t size_ = 0;
+  uint64_t page_size_ = 0;
+  std::string backing_;
+
+  // madvise(MADV_HUGEPAGE) succeeds even with THP set to `never`, so 2 MiB 
+  // pages are only claimed if the policy allows them and a scratch huge 
+  // page, once touched, shows up in its mapping's AnonHugePages. Guest RAM 
+  // itself is left untouched until it is bound to its NUMA node. Checked 
+  // once per process.
+  static bool THPAvailable() {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    static const bool available = [] {
+      std::string policy;
+      if (!read_file("/sys/kernel/mm/transparent_hugepage/enabled", policy) || 
+          (policy.find("[always]") == std::string::npos && policy.find("[madvise]") == std::string::npos)) return false;
+
+      const uint64_t huge = uint64_t(2) << 20;
+      void *map = mmap(nullptr, 2 * huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (map == MAP_FAILED) return false;
+      const auto start = (reinterpret_cast<uintptr_t>(map) + huge - 1) / huge * huge;
+      bool backed = false;
+      if (madvise(reinterpret_cast<void*>(start), huge, MADV_HUGEPAGE) == 0) {
+        *reinterpret_cast<volatile uint8_t*>(start) = 0;
+        std::ifstream smaps("/proc/self/smaps");
+        bool in_mapping = false;
+        for (std::string line; std::getline(smaps, line);) {
+          unsigned long from = 0, to = 0, kb = 0;
+          if (std::sscanf(line.c_str(), "%lx-%lx", &from, &to) == 2) in_mapping = from <= start && start < to;
+          else if (in_mapping && std::sscanf(line.c_str(), "AnonHugePages: %lu kB", &kb) == 1) {
+            backed = kb > 0;
+            break;
+          }
+        }
+      }
+      munmap(map, 2 * huge);
+      return backed;
+    }();
+    return available;
+#else
+    return true;
+#endif
+  }
+
+public:
+  // `huge_page` is 0 for regular pages, 1 for transparent huge pages only, 
+  // or the hugetlb page size to try first (2 MiB, 1 GiB, ...).
+  void Allocate(uint64_t size, uint64_t huge_page) {
+    Free();
+#if defined(_WIN32)
+    (void)huge_page;
+    data_ = static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    if (!data_) therr(func, "Cannot allocate " + format_size(size) + " of guest memory");
+    size_ = size;
+    page_size_ = 4096;
+    backing_ = "regular pages";
+#else
+    const uint64_t page = sysconf(_SC_PAGESIZE);
+
+  #if defined(MAP_HUGETLB)
+    if (huge_page > 1) {
+      uint64_t rounded = (size + huge_page - 1) / huge_page * huge_page;
+      // No MAP_NORESERVE: an empty hugetlb pool must fail here, not SIGBUS later.
+      int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+    #if defined(MAP_HUGE_SHIFT)
+      flags |= __builtin_ctzll(huge_page) << MAP_HUGE_SHIFT;
+    #endif
+      void *map = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, flags, -1, 0);
+      if (map != MAP_FAILED) {
+        data_ = static_cast<uint8_t*>(map);
+        size_ = rounded;
+        page_size_ = huge_page;
+        backing_ = "hugetlb";
+        return;
+      }
+    }
+  #endif
+
+    // Over-allocate so the usable range starts on a 2 MiB boundary, which 
+    // is what lets the kernel back it with transparent huge pages.
+    const uint64_t align = huge_page ? (uint64_t(2) << 20) : page;
+    uint64_t rounded = (size + page - 1) / page * page;
+    void *map = mmap(nullptr, rounded + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) therr(func, "Cannot allocate " + format_size(size) + " of guest memory: " + strerror(errno));
+
+    auto raw = reinterpret_cast<uintptr_t>(map);
+    auto aligned = (raw + align - 1) / align * align;
+    if (aligned > raw) munmap(map, aligned - raw);
+    if (aligned + rounded < raw + rounded + align) 
+      munmap(reinterpret_cast<void*>(aligned + rounded), raw + rounded + align - aligned - rounded);
+
+    data_ = reinterpret_cast<uint8_t*>(aligned);
+    size_ = rounded;
+    page_size_ = page;
+    backing_ = "regular pages";
+
+  #if defined(MADV_HUGEPAGE)
+    if (huge_page && madvise(data_, size_, MADV_HUGEPAGE) == 0 && THPAvailable()) {
+      page_size_ = uint64_t(2) << 20;
+      backing_ = "transparent huge pages";
+    }
+  #endif
+#endif
+  }
+
+  void Free() {
+    if (data_) {
+#if defined(_WIN32)
+      VirtualFree(data_, 0, MEM_RELEASE);
+#else
+      munmap(data_, size_);
+#endif
+    }
+    data_ = nullptr;
+    size_ = 0;
+    page_size_ = 0;
+    backing_.clear();
+  }
+
+  uint8_t *Data() const { return data_; }
+  uint64_t Size() const { return size_; }
+  uint64_t PageSize() const { return page_size_; }
+  const std::string &Backing() const { return backing_; }
+
+  GuestRAM() = default;
+  GuestRAM(const GuestRAM&) = delete;
+  GuestRAM &operator=(const GuestRAM&) = delete;
+  ~GuestRAM() { Free(); }
+};
+
+// The `-file` program image. Mapped MAP_PRIVATE, so loading is O(1) and 
+// only the pages the guest actually writes are ever copied.
+class ProgramImage {
+private:
+  uint8_t *data_ = nullptr;
+  uint64_t size_ = 0;
+#if defined(_WIN32)
+  std::vector<uint8_t> buffer_;
+#endif
+
+public:
+  enum class LoadMode { Lazy, Populate, WillNeed };
+
+  static LoadMode ParseLoadMode(const std::string &mode) {
+    auto m = to_lowercase(mode);
+    if (m == "lazy") return LoadMode::Lazy;
+    if (m == "populate") return LoadMode::Populate;
+    if (m == "willneed") return LoadMode::WillNeed;
+    therr(func, "Unknown image load mode: `" + mode + "` (expected lazy, populate or willneed)");
+    return LoadMode::Lazy;
+  }
+
+  void Map(const fs::path &file, LoadMode mode = LoadMode::Lazy) {
+    Unmap();
+#if defined(_WIN32)
+    (void)mode;
+    std::string bytes;
+    if (!read_file(file, bytes)) therr(func, "Cannot read program image `" + file.string() + "`");
+    buffer_.assign(bytes.begin(), bytes.end());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+#else
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) therr(func, "Cannot open program image `" + file.string() + "`: " + strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      therr(func, "Cannot stat program image `" + file.string() + "`: " + strerror(errno));
+    }
+
+    size_ = st.st_size;
+    if (size_ == 0) {
+      close(fd);
+      return;
+    }
+
+    int flags = MAP_PRIVATE;
+  #if defined(MAP_POPULATE)
+    if (mode == LoadMode::Populate) flags |= MAP_POPULATE;
+  #endif
+    void *map = mmap(nullptr, size_, PROT_READ | PROT_WRITE, flags, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+      size_ = 0;
+      therr(func, "Cannot map program image `" + file.string() + "`: " + strerror(errno));
+    }
+
+    data_ = static_cast<uint8_t*>(map);
+    if (mode == LoadMode::WillNeed) madvise(data_, size_, MADV_WILLNEED);
+#endif
+  }
+
+  void Unmap() {
+#if defined(_WIN32)
+    buffer_.clear();
+#else
+    if (data_) munmap(data_, size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  uint8_t *Data() const { return data_; }
+  uint64_t Size() const { return size_; }
+
+  ProgramImage() = default;
+  ProgramImage(const ProgramImage&) = delete;
+  ProgramImage &operator=(const ProgramImage&) = delete;
+  ~ProgramImage() { Unmap(); }
+};
+
 class Memory {
 private:
-  DynamicLibrary lib;
-  Tfunc_MemoryGetSize    EGetSize;
-  Tfunc_MemoryGetPointer EGetPointer;
-  Tfunc_SignVoid         EClear;
+  ModuleInstance lib;
+  ModuleEntry<Tfunc_MemoryGetSize>    EGetSize;
+  ModuleEntry<Tfunc_MemoryGetPointer> EGetPointer;
+  ModuleEntry<Tfunc_SignVoid>         EClear;
+  ModuleEntry<Tfunc_MemoryLoadImage>  ELoadImage;
+  ModuleEntry<Tfunc_MemoryGetMap>     EGetMap;
+  ModuleEntry<Tfunc_MemoryAttach>     EAttach;
+  uint64_t               AttachedPageSize = 0;
+  ModuleTimings          Timings;
+
+  // v1 modules only expose get_pointer/get_size: the host describes that 
+  // as a single RW region so every CPU can be handed a table.
+  tinyw_mem_region ShimRegion{};
+  tinyw_mem_map    ShimMap{};
+  const tinyw_mem_map *Map = nullptr;
+
+  void LoadMap(const fs::path &path) {
+    if (EGetMap) {
+      Map = EGetMap();
+      if (!Map || Map->version != TINYW_MEM_MAP_VERSION || (Map->count && !Map->regions)) {
+        std::stringstream errmsg;
+        errmsg << "Invalid memory map published by " << path << "\n"
+        "* map:\t" << (const void*)Map << "\n"
+        "* version:\t" << (Map ? Map->version : 0) << " (expected " << TINYW_MEM_MAP_VERSION << ")\n";
+        therr(func, errmsg.str());
+      }
+      return;
+    }
+
+    ShimRegion = tinyw_mem_region{
+      .base = EGetPointer(),
+      .guest_addr = 0,
+      .size = EGetSize(),
+      .flags = TINYW_REGION_RW,
+      .page_size = (uint32_t)(AttachedPageSize ? AttachedPageSize : HostPageSize()),
+    };
+    ShimMap = tinyw_mem_map{
+      .version = TINYW_MEM_MAP_VERSION,
+      .count = 1,
+      .regions = &ShimRegion,
+    };
+    Map = &ShimMap;
+  }
 
 public:
-  Tfunc_MemoryGetSize get_EGetSize() const { return EGetSize; }
-  Tfunc_MemoryGetPointer get_EGetPointer() const { return EGetPointer; }
+  static size_t HostPageSize() {
+#if defined(_WIN32)
+    return 4096;
+#else
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    return page;
+#endif
+  }
+
+  // Region table of the loaded module (or the v1 shim), valid until clear().
+  const tinyw_mem_map *GetMap() const { return Map; }
+
+  // v1 accessors for v1 CPU modules; null for instance memory modules.
+  Tfunc_MemoryGetSize get_EGetSize() const { return EGetSize.Plain(); }
+  Tfunc_MemoryGetPointer get_EGetPointer() const { return EGetPointer.Plain(); }
+
+  bool is_instance() const { return lib.IsInstance(); }
+
+  const ModuleTimings &get_timings() const { return Timings; }
 
   uint64_t GetSize() { return EGetSize(); }
   uint8_t *GetPointer() { return EGetPointer(); }
 
-  void init(const fs::path &path, const std::vector<std::string> &argv) {
-    if (!lib.Open(path)) {
+  // `ram`, when allocated, is handed to the module before `init`.
+  void init(const fs::path &path, const std::vector<std::string> &argv, const GuestRAM *ram = nullptr, 
+            const ModuleAttachments &Attachments = {}) {
+    auto opening = std::chrono::steady_clock::now();
+    bool opened = lib.Open(path);
+    Timings.open = std::chrono::steady_clock::now() - opening;
+    if (!opened) {
       std::cerr << "> Cannot open file " << path << std::endl;
       std::cerr << "> [i:err]: " << lib.Error() << std::endl;
       return;
     }
 
-    EGetSize    = (Tfunc_MemoryGetSize)lib.GetSymbol("get_size");
-    EGetPointer = (Tfunc_MemoryGetPointer)lib.GetSymbol("get_pointer");
-    EClear      = (Tfunc_SignVoid)lib.GetSymbol("clear");
-    auto Einit  = (Tfunc_InitArgv)lib.GetSymbol("init");
+    ModuleEntry<Tfunc_InitArgv> Einit;
+    EGetSize.Bind(lib, "get_size", "");
+    EGetPointer.Bind(lib, "get_pointer", "");
+    EClear.Bind(lib, "clear");
+    ELoadImage.Bind(lib, "load_image");
+    EGetMap.Bind(lib, "get_memory_map");
+    EAttach.Bind(lib, "attach_memory");
+    Einit.Bind(lib, "init");
 
-    if (!EGetSize || !EGetPointer || !Einit || !EClear) {
+    // Instance modules have no v1 accessors, the region table replaces them.
+    if (((!EGetSize || !EGetPointer) && !(lib.IsInstance() && EGetMap)) || !Einit || !EClear) {
       std::stringstream errmsg;
-      errmsg << "Failed to load required symbols from " << path << "\n"
+      errmsg << "Failed to load required symbols from " << path << (lib.IsInstance() ? " (instance module)" : "") << "\n"
       "handles:\n"
-      "* EGetPointer:\t" << is_true(EGetPointer == nullptr) << "\n"
-      "* EGetSize:\t" << is_true(EGetSize == nullptr) << "\n"
-      "* Einit: \t" << is_true(Einit == nullptr) << "\n";
+      "* EGetPointer:\t" << is_true(!EGetPointer) << "\n"
+      "* EGetSize:\t" << is_true(!EGetSize) << "\n"
+      "* EGetMap:\t" << is_true(!EGetMap) << "\n"
+      "* Einit: \t" << is_true(!Einit) << "\n";
       therr(func, errmsg.str());
     }
 
+    lib.Attach("attach_host", TINYW_ATTACH_HOST, Attachments.host);
+    lib.Attach("attach_stop_token", TINYW_ATTACH_STOP_TOKEN, Attachments.stop);
+    lib.Attach("attach_tracer", TINYW_ATTACH_TRACER, Attachments.tracer);
+
+    if (ram && ram->Data()) {
+      if (!EAttach) therr(func, "Host-allocated memory requested, but " + path.string() + " does not export `attach_memory`");
+      EAttach(ram->Data(), ram->Size(), (uint32_t)ram->PageSize());
+      AttachedPageSize = ram->PageSize();
+    }
+
     std::vector<char*> cstr_argv;
     cstr_argv.reserve(argv.size());
     for (const auto& arg : argv) {
       cstr_argv.push_back(cstrdup(arg.c_str()));
     }
 
+    auto initializing = std::chrono::steady_clock::now();
     Einit(cstr_argv.size(), cstr_argv.data());
+    Timings.init = std::chrono::steady_clock::now() - initializing;
 
     for (auto ptr : cstr_argv) {
       free(ptr);
     }
+
+    LoadMap(path);
   }
 
-  void clear() { return EClear(); }
+  bool can_load_image() const { return bool(ELoadImage); }
+
+  void load_image(const ProgramImage &image, uint64_t offset) {
+    ELoadImage(image.Data(), image.Size(), offset);
+  }
+
+  void clear() { 
+    EClear(); 
+    Map = nullptr;
+  }
 };
 
 TinyWDeclEnd
\ No newline at end of file
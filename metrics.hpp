@@ -0,0 +1,209 @@
+#pragma once
+
+#include <bit>
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sstream>
+#include <utility>
+#include <iomanip>
+#include <algorithm>
+#include <filesystem>
+
+#include "glob.hpp"
+#include "tasks.hpp"
+
+TinyWDeclStart
+
+// Log-linear histogram in the spirit of HdrHistogram: a value lands in the
+// bucket of its highest set bit, split in 16 linear sub-buckets, so every
+// bucket is at most 1/16 (6.25%) wide relative to its values. Recording is
+// a handful of relaxed atomic operations and never allocates.
+class Histogram {
+private:
+  static constexpr unsigned SubBits = 4;
+  static constexpr uint64_t Sub = uint64_t(1) << SubBits;
+  static constexpr size_t Buckets = (64 - SubBits + 1) * Sub;
+
+  std::atomic<uint64_t> counts_[Buckets] = {};
+  std::atomic<uint64_t> count_{0}, sum_{0}, max_{0};
+  std::atomic<uint64_t> min_{UINT64_MAX};
+
+  static size_t Index(uint64_t value) {
+    if (value < Sub) return value;
+    unsigned shift = std::bit_width(value) - 1 - SubBits;
+    return (shift + 1) * Sub + ((value >> shift) & (Sub - 1));
+  }
+
+  static uint64_t Lower(size_t index) {
+    if (index < Sub) return index;
+    return (Sub + index % Sub) << (index / Sub - 1);
+  }
+
+public:
+  void Record(uint64_t value) {
+    counts_[Index(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t seen = max_.load(std::memory_order_relaxed);
+    while (value > seen && !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+    seen = min_.load(std::memory_order_relaxed);
+    while (value < seen && !min_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+  }
+
+  uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t Sum() const { return sum_.load(std::memory_order_relaxed); }
+  uint64_t Max() const { return max_.load(std::memory_order_relaxed); }
+  uint64_t Min() const { return Count() ? min_.load(std::memory_order_relaxed) : 0; }
+
+  // Upper bound of the bucket holding the value of rank ceil(q * count).
+  uint64_t Quantile(double q) const {
+    const uint64_t count = Count();
+    if (count == 0) return 0;
+    uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * count)), seen = 0;
+    for (size_t i = 0; i < Buckets; i++) {
+      seen += counts_[i].load(std::memory_order_relaxed);
+      if (seen >= rank) return std::min(Max(), i + 1 < Buckets ? Lower(i + 1) - 1 : UINT64_MAX);
+    }
+    return Max();
+  }
+};
+
+// What a run reports at exit (`-core metrics <path>`): flat samples with
+// labels, plus histograms. Written as `<path>.json` and as `<path>.prom` in
+// the Prometheus text format, for the node exporter's textfile collector.
+class RunMetrics {
+public:
+  typedef std::vector<std::pair<std::string, std::string>> Labels;
+
+private:
+  struct Sample {
+    std::string name, help;
+    Labels labels;
+    double value;
+  };
+
+  struct Summary {
+    std::string name, help;
+    const Histogram *histogram;
+    double scale;   // recorded unit -> reported unit
+  };
+
+  static constexpr double Quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+  mutable std::mutex lock_;
+  std::vector<Sample> samples_;
+  std::vector<Summary> summaries_;
+
+  static std::string Number(double value) {
+    std::ostringstream out;
+    out << std::setprecision(9) << value;
+    return out.str();
+  }
+
+  // Label values in the text exposition format: only backslash, double 
+  // quote and line feed are escaped, everything else goes through as is.
+  static std::string PromEscape(const std::string &value) {
+    std::string out;
+    out.reserve(value.size());
+    for (char c : value) {
+      if (c == '\\') out += "\\\\";
+      else if (c == '"') out += "\\\"";
+      else if (c == '\n') out += "\\n";
+      else out += c;
+    }
+    return out;
+  }
+
+  static std::string PromLabels(const Labels &labels, const std::string &extra = "") {
+    std::string out;
+    for (const auto &[key, value] : labels) out += (out.empty() ? "" : ",") + key + "=\"" + PromEscape(value) + "\"";
+    if (!extra.empty()) out += (out.empty() ? "" : ",") + extra;
+    return out.empty() ? "" : "{" + out + "}";
+  }
+
+public:
+  void Set(const std::string &name, const std::string &help, double value, const Labels &labels = {}) {
+    std::lock_guard<std::mutex> lock(lock_);
+    samples_.push_back({ name, help, labels, value });
+  }
+
+  void Time(const std::string &name, const std::string &help, std::chrono::steady_clock::duration elapsed,
+            const Labels &labels = {}) {
+    Set(name, help, std::chrono::duration<double>(elapsed).count(), labels);
+  }
+
+  // `histogram` must outlive the report.
+  void AddSummary(const std::string &name, const std::string &help, const Histogram &histogram, double scale = 1.0) {
+    std::lock_guard<std::mutex> lock(lock_);
+    summaries_.push_back({ name, help, &histogram, scale });
+  }
+
+  std::string ToJSON() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    std::ostringstream out;
+    out << "{\n  \"metrics\": [";
+    for (size_t i = 0; i < samples_.size(); i++) {
+      const auto &s = samples_[i];
+      out << (i ? "," : "") << "\n    { \"name\": \"" << json_escape(s.name) << "\", \"labels\": {";
+      for (size_t j = 0; j < s.labels.size(); j++)
+        out << (j ? ", " : " ") << "\"" << json_escape(s.labels[j].first) << "\": \"" << json_escape(s.labels[j].second) << "\"";
+      out << (s.labels.empty() ? "" : " ") << "}, \"value\": " << Number(s.value) << " }";
+    }
+    out << "\n  ],\n  \"histograms\": {";
+    for (size_t i = 0; i < summaries_.size(); i++) {
+      const auto &h = summaries_[i];
+      out << (i ? "," : "") << "\n    \"" << json_escape(h.name) << "\": { \"count\": " << h.histogram->Count()
+          << ", \"sum\": " << Number(h.histogram->Sum() * h.scale)
+          << ", \"min\": " << Number(h.histogram->Min() * h.scale)
+          << ", \"max\": " << Number(h.histogram->Max() * h.scale);
+      for (double q : Quantiles) out << ", \"p" << Number(q * 100) << "\": " << Number(h.histogram->Quantile(q) * h.scale);
+      out << " }";
+    }
+    out << "\n  }\n}\n";
+    return out.str();
+  }
+
+  std::string ToPrometheus() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    std::ostringstream out;
+    // All samples of a metric must follow its HELP/TYPE lines.
+    std::vector<std::string> names;
+    for (const auto &s : samples_) 
+      if (std::find(names.begin(), names.end(), s.name) == names.end()) names.push_back(s.name);
+    for (const auto &name : names) {
+      bool described = false;
+      for (const auto &s : samples_) {
+        if (s.name != name) continue;
+        if (!described) out << "# HELP " << s.name << " " << s.help << "\n# TYPE " << s.name << " gauge\n";
+        described = true;
+        out << s.name << PromLabels(s.labels) << " " << Number(s.value) << "\n";
+      }
+    }
+    for (const auto &h : summaries_) {
+      out << "# HELP " << h.name << " " << h.help << "\n# TYPE " << h.name << " summary\n";
+      for (double q : Quantiles)
+        out << h.name << PromLabels({}, "quantile=\"" + Number(q) + "\"") << " " << Number(h.histogram->Quantile(q) * h.scale) << "\n";
+      out << h.name << "_sum " << Number(h.histogram->Sum() * h.scale) << "\n";
+      out << h.name << "_count " << h.histogram->Count() << "\n";
+    }
+    return out.str();
+  }
+
+  // `<path>.json` and `<path>.prom`; a `.json` or `.prom` extension on
+  // `path` itself is dropped first.
+  void Write(fs::path path) const {
+    if (path.extension() == ".json" || path.extension() == ".prom") path.replace_extension();
+    if (path.has_parent_path()) fs::create_directories(path.parent_path());
+    const auto json = ToJSON(), prom = ToPrometheus();
+    write_file_atomic(fs::path(path) += ".json", json.data(), json.size());
+    write_file_atomic(fs::path(path) += ".prom", prom.data(), prom.size());
+  }
+};
+
+TinyWDeclEnd
@@ -0,0 +1,372 @@
+/* fastcpu: the reference bytecode of `builtin:refcpu` (builtin.hpp), run
+ * the way a fast interpreter does it. builtin:refcpu is the naive switch
+ * loop; this is the template to copy:
+ *
+ *   - guest code is decoded once, a 4 KiB guest page at a time, into a
+ *     cache keyed by guest address: register numbers are masked, immediates
+ *     sign-extended and branch targets resolved ahead of time;
+ *   - handlers are chained with computed gotos (GCC, Clang), one indirect
+ *     jump per instruction at the end of each handler, so the branch
+ *     predictor sees each handler's successors; other compilers get the
+ *     same handlers in a switch;
+ *   - hot pairs are fused at decode time into superinstructions, one
+ *     dispatch for both: ADDI+BNZ (loop counters), LD+ADDI and ST+ADDI
+ *     (pointer walks);
+ *   - guest stores (ST, COPY) drop the decoded pages they overwrite, so
+ *     self-modifying code stays correct, at the cost of a page decode.
+ *
+ * ISA: 16 64-bit registers, little-endian, 4-byte instructions `op a b c`
+ * (register fields use their low 4 bits), execution from the first byte
+ * of the first memory region. Memory operands are guest addresses held in
+ * registers.
+ *
+ *   0x00 HALT            stop the run
+ *   0x01 LI   a          ra = imm64, the 8 bytes after the instruction
+ *   0x02 ADD  a b c      ra = rb + rc
+ *   0x03 SUB  a b c      ra = rb - rc
+ *   0x04 ADDI a b c      ra = rb + (int8_t)c
+ *   0x05 LD   a b        ra = mem64[rb]
+ *   0x06 ST   a b        mem64[rb] = ra
+ *   0x07 BNZ  a b c      if ra != 0: pc += 4 * (int16_t)(b | c << 8),
+ *                        counted from the next instruction
+ *   0x08 SEND a b        push mem[ra, ra + rb) to the GPU queue
+ *   0x09 COPY a b c      memmove(mem[ra], mem[rb], rc)
+ *   0x0a XOR  a b c      ra = rb ^ rc
+ *   0x0b MUL  a b c      ra = rb * rc
+ *
+ * Any other opcode, or an access outside the region, stops the CPU and is
+ * reported through the host's `fail`.
+ * `-cpu fuse off` disables the superinstructions, for comparison. Lockstep
+ * `step` budgets are checked at taken branches and page boundaries, so a
+ * step may run over by one straight-line stretch of a page.
+ *
+ *   g++ -std=c++20 -O2 -shared -fPIC -I ~/.tinyw/include modules/fastcpu.cpp -o libfastcpu.so
+ *   tinyw bench -cpu file ./libfastcpu.so
+ *
+ * or, linked into tinyw as `builtin:fastcpu` (see TINYW_STATIC_MODULE):
+ *   g++ -std=c++20 -O2 -flto -I ~/.tinyw/include -DTINYW_STATIC_MODULE=fastcpu -c modules/fastcpu.cpp
+ *   g++ -std=c++20 -O2 -flto tinyw.cpp fastcpu.o -o tinyw -ldl -lpthread */
+
+#include <tinyw/tinyc.h>
+#include <tinyw/mem_view.hpp>
+
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#if defined(__GNUC__) || defined(__clang__)
+  #define FASTCPU_THREADED 1
+#else
+  #define FASTCPU_THREADED 0
+#endif
+
+namespace {
+
+enum Op : uint8_t {
+  Halt = 0x00, Li = 0x01, Add = 0x02, Sub = 0x03, Addi = 0x04, Ld = 0x05,
+  St = 0x06, Bnz = 0x07, Send = 0x08, Copy = 0x09, Xor = 0x0a, Mul = 0x0b,
+
+  // Only produced by the decoder.
+  AddiBnz,   // superinstructions: this slot and the next, one dispatch
+  LdAddi,
+  StAddi,
+  Invalid,   // undefined opcode, kept in `a`
+  Truncated, // instruction running past the end of the region
+  Refetch,   // past the last slot of a page
+  OpCount
+};
+
+struct Insn {
+  uint8_t op, a, b, c;
+  int64_t imm;   // LI: the immediate; ADDI: (int8_t)c; BNZ: region offset of the target
+};
+
+constexpr uint64_t PageBits = 12;
+constexpr uint64_t PageSize = uint64_t(1) << PageBits;
+constexpr uint64_t Slots = PageSize / 4;
+
+struct Page {
+  uint64_t offset;             // region offset of slots[0]
+  Insn slots[Slots + 3];       // + Refetch sentinels: a LI in the last slot skips 3
+};
+
+class Machine {
+  tinyw::le_view<> ram_;
+  uint64_t reg_[16] = {};
+  uint64_t pc_ = 0;            // region offset
+  bool halted_ = false;
+  bool fuse_ = true;
+  std::vector<std::unique_ptr<Page>> pages_;
+
+  const tinyw_gpu_queue *queue_ = nullptr;
+  const tinyw_host_services *host_ = nullptr;
+
+  Insn DecodeAt(uint64_t offset) const {
+    Insn in{};
+    if (offset >= ram_.size() || ram_.size() - offset < 4) return in.op = Truncated, in;
+    const uint8_t *p = ram_.data() + offset;
+    in = Insn{ p[0], uint8_t(p[1] & 15), uint8_t(p[2] & 15), uint8_t(p[3] & 15), 0 };
+    switch (p[0]) {
+      case Li:
+        if (ram_.size() - offset < 12) in.op = Truncated;
+        else in.imm = (int64_t)ram_.u64(ram_.guest_addr() + offset + 4);
+        break;
+      case Addi: in.imm = (int8_t)p[3]; break;
+      case Bnz:  in.imm = (int64_t)(offset + 4) + 4 * (int64_t)(int16_t)(p[2] | p[3] << 8); break;
+      default:   if (p[0] > Mul) in.op = Invalid, in.a = p[0]; break;
+    }
+    return in;
+  }
+
+  std::unique_ptr<Page> Decode(uint64_t offset) const {
+    auto page = std::make_unique<Page>();
+    page->offset = offset;
+    for (uint64_t i = 0; i < Slots; i++) page->slots[i] = DecodeAt(offset + 4 * i);
+    for (uint64_t i = Slots; i < Slots + 3; i++) page->slots[i] = Insn{ Refetch, 0, 0, 0, 0 };
+    if (!fuse_) return page;
+
+    // Fusing never changes what runs: the second slot is still decoded on
+    // its own for branches that land on it.
+    for (uint64_t i = 0; i + 1 < Slots; i++) {
+      auto &first = page->slots[i].op;
+      const auto second = page->slots[i + 1].op;
+      if (first == Addi && second == Bnz) first = AddiBnz;
+      else if (first == Ld && second == Addi) first = LdAddi;
+      else if (first == St && second == Addi) first = StAddi;
+    }
+    return page;
+  }
+
+  Page *Fetch(uint64_t offset) {
+    if (offset >= ram_.size()) return nullptr;
+    auto &page = pages_[offset >> PageBits];
+    if (!page) page = Decode(offset & ~(PageSize - 1));
+    return page.get();
+  }
+
+  // Drops the pages decoded from bytes [offset, offset + len) of the region;
+  // a page reads up to 8 bytes into the next one (the immediate of a LI in
+  // its last slot). True if any was dropped.
+  bool Written(uint64_t offset, uint64_t len) {
+    bool dropped = false;
+    const uint64_t last = std::min<uint64_t>((offset + len - 1) >> PageBits, pages_.size() - 1);
+    for (uint64_t p = (offset >= 8 ? offset - 8 : 0) >> PageBits; p <= last; p++) {
+      if (pages_[p]) pages_[p].reset(), dropped = true;
+    }
+    return dropped;
+  }
+
+  void Fail(const char *message) {
+    halted_ = true;
+    if (host_ && (host_->capabilities & TINYW_HOST_CAP_FAIL)) tinyw_host_fail(host_, message);
+    else std::fprintf(stderr, "> %s\n", message);
+  }
+
+  void Fail(const char *what, uint64_t value) {
+    char message[160];
+    std::snprintf(message, sizeof message, "fastcpu: %s 0x%llx (pc 0x%llx)", what,
+                  (unsigned long long)value, (unsigned long long)(ram_.guest_addr() + pc_));
+    Fail(message);
+  }
+
+public:
+  bool Halted() const { return halted_; }
+
+  void Attach(const tinyw_gpu_queue *queue) { queue_ = queue; }
+  void Attach(const tinyw_host_services *host) { host_ = host; }
+
+  void Init(const tinyw_mem_map *map, uint64_t argc, char *const argv[]) {
+    for (uint64_t i = 0; i + 1 < argc; i++) {
+      if (!std::strcmp(argv[i], "fuse")) fuse_ = std::strcmp(argv[i + 1], "off") && std::strcmp(argv[i + 1], "0");
+    }
+    std::memset(reg_, 0, sizeof reg_);
+    pc_ = 0;
+    halted_ = false;
+    pages_.clear();
+    if (!map || !map->count || !map->regions[0].base) return Fail("fastcpu: needs at least one memory region");
+    ram_ = tinyw::le_view<>(map->regions[0]);
+    pages_.resize((ram_.size() + PageSize - 1) / PageSize);
+  }
+
+  // Runs until HALT, a fault, or about `budget` instructions; returns how
+  // many ran.
+  uint64_t Run(uint64_t budget) {
+    if (halted_) return 0;
+    uint64_t n = 0, target = 0;
+    uint64_t *const r = reg_;
+    Page *page = nullptr;
+    const Insn *slots = nullptr, *ip = nullptr;
+    uint64_t page_offset = 0;
+
+    // `page` may be freed by a store into it: positions are computed from
+    // these copies, never by reading the page again.
+#define FASTCPU_PC(ip) (page_offset + uint64_t((ip) - slots) * 4)
+
+#if FASTCPU_THREADED
+    static const void *const handlers[OpCount] = {
+      &&op_Halt, &&op_Li, &&op_Add, &&op_Sub, &&op_Addi, &&op_Ld, &&op_St, &&op_Bnz,
+      &&op_Send, &&op_Copy, &&op_Xor, &&op_Mul, &&op_AddiBnz, &&op_LdAddi, &&op_StAddi,
+      &&op_Invalid, &&op_Truncated, &&op_Refetch,
+    };
+#define FASTCPU_OP(name) op_##name:
+#define FASTCPU_NEXT() goto *handlers[ip->op]
+#else
+#define FASTCPU_OP(name) case name:
+#define FASTCPU_NEXT() goto dispatch
+#endif
+
+  refetch:
+    if (n >= budget) return n;
+    if (!(page = Fetch(pc_))) return Fail("pc outside of guest memory:", ram_.guest_addr() + pc_), n;
+    slots = page->slots;
+    page_offset = page->offset;
+    ip = slots + (pc_ - page_offset) / 4;
+
+#if FASTCPU_THREADED
+    FASTCPU_NEXT();
+#else
+  dispatch:
+    switch (ip->op) {
+#endif
+
+    FASTCPU_OP(Halt)
+      pc_ = FASTCPU_PC(ip);
+      halted_ = true;
+      return n + 1;
+
+    FASTCPU_OP(Li)   r[ip->a] = ip->imm; ip += 3; n++; FASTCPU_NEXT();
+    FASTCPU_OP(Add)  r[ip->a] = r[ip->b] + r[ip->c]; ip++; n++; FASTCPU_NEXT();
+    FASTCPU_OP(Sub)  r[ip->a] = r[ip->b] - r[ip->c]; ip++; n++; FASTCPU_NEXT();
+    FASTCPU_OP(Addi) r[ip->a] = r[ip->b] + ip->imm; ip++; n++; FASTCPU_NEXT();
+    FASTCPU_OP(Xor)  r[ip->a] = r[ip->b] ^ r[ip->c]; ip++; n++; FASTCPU_NEXT();
+    FASTCPU_OP(Mul)  r[ip->a] = r[ip->b] * r[ip->c]; ip++; n++; FASTCPU_NEXT();
+
+    FASTCPU_OP(Ld)
+      r[ip->a] = ram_.u64(r[ip->b]);
+      if (ram_.faulted()) [[unlikely]] goto fault;
+      ip++; n++; FASTCPU_NEXT();
+
+    FASTCPU_OP(St)
+      ram_.store<uint64_t>(r[ip->b], r[ip->a]);
+      if (ram_.faulted()) [[unlikely]] goto fault;
+      n++;
+      if (Written(r[ip->b] - ram_.guest_addr(), 8)) [[unlikely]] { pc_ = FASTCPU_PC(ip) + 4; goto refetch; }
+      ip++; FASTCPU_NEXT();
+
+    FASTCPU_OP(Bnz)
+      n++;
+      if (r[ip->a]) { target = ip->imm; goto jump; }
+      ip++; FASTCPU_NEXT();
+
+    FASTCPU_OP(Send) {
+      const uint64_t addr = r[ip->a], len = r[ip->b];
+      if (!ram_.contains(addr, len)) [[unlikely]] { pc_ = FASTCPU_PC(ip); return Fail("send outside of guest memory at", addr), n; }
+      n++;
+      if (queue_ && tinyw_gpu_push(queue_, ram_.data() + (addr - ram_.guest_addr()), len) == TINYW_QUEUE_CLOSED) {
+        pc_ = FASTCPU_PC(ip) + 4;
+        halted_ = true;
+        return n;
+      }
+      ip++; FASTCPU_NEXT();
+    }
+
+    FASTCPU_OP(Copy) {
+      const uint64_t dst = r[ip->a], src = r[ip->b], len = r[ip->c];
+      if (!ram_.contains(dst, len) || !ram_.contains(src, len)) [[unlikely]] {
+        pc_ = FASTCPU_PC(ip);
+        return Fail("copy outside of guest memory at", ram_.contains(dst, len) ? src : dst), n;
+      }
+      std::memmove(ram_.data() + (dst - ram_.guest_addr()), ram_.data() + (src - ram_.guest_addr()), len);
+      n++;
+      if (len && Written(dst - ram_.guest_addr(), len)) [[unlikely]] { pc_ = FASTCPU_PC(ip) + 4; goto refetch; }
+      ip++; FASTCPU_NEXT();
+    }
+
+    FASTCPU_OP(AddiBnz)
+      r[ip->a] = r[ip->b] + ip->imm;
+      n += 2;
+      if (r[ip[1].a]) { target = ip[1].imm; goto jump; }
+      ip += 2; FASTCPU_NEXT();
+
+    FASTCPU_OP(LdAddi)
+      r[ip->a] = ram_.u64(r[ip->b]);
+      if (ram_.faulted()) [[unlikely]] goto fault;
+      r[ip[1].a] = r[ip[1].b] + ip[1].imm;
+      ip += 2; n += 2; FASTCPU_NEXT();
+
+    // If the store hit decoded code, the ADDI itself may be stale: it runs
+    // again from a fresh decode.
+    FASTCPU_OP(StAddi)
+      ram_.store<uint64_t>(r[ip->b], r[ip->a]);
+      if (ram_.faulted()) [[unlikely]] goto fault;
+      n++;
+      if (Written(r[ip->b] - ram_.guest_addr(), 8)) [[unlikely]] { pc_ = FASTCPU_PC(ip) + 4; goto refetch; }
+      r[ip[1].a] = r[ip[1].b] + ip[1].imm;
+      ip += 2; n++; FASTCPU_NEXT();
+
+    FASTCPU_OP(Invalid)
+      pc_ = FASTCPU_PC(ip);
+      return Fail("invalid opcode", ip->a), n;
+
+    FASTCPU_OP(Truncated)
+      pc_ = FASTCPU_PC(ip);
+      return Fail("instruction runs past the end of guest memory at", ram_.guest_addr() + pc_), n;
+
+    FASTCPU_OP(Refetch)
+      pc_ = FASTCPU_PC(ip);
+      goto refetch;
+
+#if !FASTCPU_THREADED
+      default: pc_ = FASTCPU_PC(ip); return Fail("invalid opcode", ip->op), n;
+    }
+#endif
+
+  jump:
+    if (n < budget && target - page_offset < PageSize) { ip = slots + (target - page_offset) / 4; FASTCPU_NEXT(); }
+    pc_ = target;
+    goto refetch;
+
+  fault:
+    pc_ = FASTCPU_PC(ip);
+    Fail("access outside of guest memory at", ram_.fault_address());
+    ram_.clear_fault();
+    return n;
+
+#undef FASTCPU_PC
+#undef FASTCPU_OP
+#undef FASTCPU_NEXT
+  }
+};
+
+Machine machine;
+const tinyw_stop_token *stop_token = nullptr;
+
+void fastcpu_init(const tinyw_mem_map *memory, uint64_t argc, char *const argv[]) { machine.Init(memory, argc, argv); }
+
+void fastcpu_start() {
+  while (!machine.Halted()) {
+    machine.Run(1 << 16);
+    if (stop_token && tinyw_stop_requested(stop_token)) break;
+  }
+}
+
+void fastcpu_stop() {}
+
+uint64_t fastcpu_step(uint64_t budget) {
+  if (machine.Halted()) return TINYW_STEP_HALTED;
+  return machine.Run(budget);
+}
+
+void fastcpu_attach_queue(const tinyw_gpu_queue *queue) { machine.Attach(queue); }
+void fastcpu_attach_host(const tinyw_host_services *host) { machine.Attach(host); }
+void fastcpu_attach_stop(const tinyw_stop_token *token) { stop_token = token; }
+
+} // namespace
+
+TINYW_CPU_MODULE_V2(fastcpu_start, fastcpu_init, fastcpu_stop)
+TINYW_CPU_GPU_QUEUE(fastcpu_attach_queue)
+TINYW_CPU_STEP(fastcpu_step)
+TINYW_STOP_TOKEN(fastcpu_attach_stop)
+TINYW_HOST_SERVICES(fastcpu_attach_host)
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <mutex>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "glob.hpp"
+
+TinyWDeclStart
+
+// Single-producer / single-consumer byte ring carrying length-prefixed
+// records from the CPU thread to the GPU drain thread. Records never wrap:
+// when one does not fit before the end of the buffer, a padding record
+// fills the tail and it starts again at offset 0.
+class CommandRing {
+public:
+  enum class Policy { Block, Drop, Overwrite };
+
+  struct Stats {
+    uint64_t capacity = 0;
+    uint64_t pushed = 0;
+    uint64_t pushed_bytes = 0;
+    uint64_t drained = 0;
+    uint64_t batches = 0;
+    uint64_t dropped = 0;
+    uint64_t overwritten = 0;
+    uint64_t high_water = 0;
+  };
+
+  static Policy ParsePolicy(const std::string &policy) {
+    auto p = to_lowercase(policy);
+    if (p == "block") return Policy::Block;
+    if (p == "drop") return Policy::Drop;
+    if (p == "overwrite") return Policy::Overwrite;
+    therr(func, "Unknown ring policy: `" + policy + "` (expected block, drop or overwrite)");
+    return Policy::Block;
+  }
+
+private:
+  static constexpr uint64_t Pad = ~uint64_t(0);
+  static constexpr uint64_t Header = sizeof(uint64_t);
+
+  static uint64_t RecordSize(uint64_t len) { return (Header + len + 7) & ~uint64_t(7); }
+
+  std::unique_ptr<uint8_t[]> buffer_;
+  uint64_t capacity_ = 0;
+  uint64_t mask_ = 0;
+  Policy policy_ = Policy::Block;
+
+  // Each side owns one cache line: head is only written by the producer,
+  // tail by the consumer (and by the producer when overwriting).
+  alignas(64) std::atomic<uint64_t> head_{0};
+  std::atomic<bool> producer_waiting_{false};
+  std::atomic<uint32_t> producer_wake_{0};
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  std::atomic<bool> consumer_waiting_{false};
+  std::atomic<uint32_t> consumer_wake_{0};
+  alignas(64) std::atomic<bool> closed_{false};
+
+  // A side only sleeps after publishing its waiting flag and re-checking
+  // the ring, so a wake-up can never fall between the check and the wait.
+  static void Wake(std::atomic<uint32_t> &wake) {
+    wake.fetch_add(1);
+    wake.notify_all();
+  }
+
+  // Producer-side counters
+  std::atomic<uint64_t> pushed_{0}, pushed_bytes_{0}, dropped_{0}, overwritten_{0}, high_water_{0};
+  // Consumer-side counters
+  std::atomic<uint64_t> drained_{0}, batches_{0};
+
+  std::vector<uint8_t> scratch_;
+  std::mutex producer_lock_;
+  std::function<void()> drain_when_full_;
+
+  uint64_t LoadHeader(uint64_t pos) const {
+    uint64_t header;
+    std::memcpy(&header, &buffer_[pos & mask_], Header);
+    return header;
+  }
+
+  void StoreHeader(uint64_t pos, uint64_t header) {
+    std::memcpy(&buffer_[pos & mask_], &header, Header);
+  }
+
+  // Size of the record starting at `pos`, including padding records.
+  uint64_t SpanAt(uint64_t pos, uint64_t header) const {
+    return header == Pad ? capacity_ - (pos & mask_) : RecordSize(header);
+  }
+
+public:
+  CommandRing(uint64_t capacity, Policy policy) : policy_(policy) {
+    capacity_ = 64;
+    while (capacity_ < capacity) capacity_ <<= 1;
+    mask_ = capacity_ - 1;
+    buffer_ = std::make_unique<uint8_t[]>(capacity_);
+  }
+
+  CommandRing(const CommandRing&) = delete;
+  CommandRing &operator=(const CommandRing&) = delete;
+
+  // Producer side. Returns TINYW_QUEUE_OK, TINYW_QUEUE_DROPPED or TINYW_QUEUE_CLOSED.
+  int32_t Push(const uint8_t *bytes, uint64_t len) {
+    const uint64_t need = RecordSize(len);
+    if (need > capacity_ / 2 || closed_.load(std::memory_order_relaxed)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return closed_.load(std::memory_order_relaxed) ? TINYW_QUEUE_CLOSED : TINYW_QUEUE_DROPPED;
+    }
+
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    const uint64_t offset = head & mask_;
+    const uint64_t pad = capacity_ - offset < need ? capacity_ - offset : 0;
+    const uint64_t total = pad + need;
+
+    for (;;) {
+      uint64_t tail = tail_.load(std::memory_order_acquire);
+      if (capacity_ - (head - tail) >= total) break;
+
+      if (policy_ == Policy::Drop) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return TINYW_QUEUE_DROPPED;
+      }
+
+      if (policy_ == Policy::Overwrite) {
+        // Evict the oldest record. The consumer may be copying it right now;
+        // its CAS on tail fails and it retries from the new tail.
+        uint64_t header = LoadHeader(tail);
+        if (tail_.compare_exchange_weak(tail, tail + SpanAt(tail, header), std::memory_order_acq_rel) && header != Pad)
+          overwritten_.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+
+      if (closed_.load(std::memory_order_relaxed)) return TINYW_QUEUE_CLOSED;
+      if (drain_when_full_) {
+        drain_when_full_();
+        continue;
+      }
+
+      uint32_t wake = producer_wake_.load();
+      producer_waiting_.store(true);
+      if (capacity_ - (head - tail_.load()) < total && !closed_.load()) producer_wake_.wait(wake);
+      producer_waiting_.store(false);
+    }
+
+    if (pad) StoreHeader(head, Pad);
+    StoreHeader(head + pad, len);
+    if (len) std::memcpy(&buffer_[(head + pad + Header) & mask_], bytes, len);
+    head_.store(head + total, std::memory_order_seq_cst);
+
+    if (consumer_waiting_.load()) Wake(consumer_wake_);
+
+    pushed_.fetch_add(1, std::memory_order_relaxed);
+    pushed_bytes_.fetch_add(len, std::memory_order_relaxed);
+    uint64_t used = head + total - tail_.load(std::memory_order_relaxed);
+    if (used > high_water_.load(std::memory_order_relaxed)) high_water_.store(used, std::memory_order_relaxed);
+    return TINYW_QUEUE_OK;
+  }
+
+  // Consumer side: hands up to `max_records` records to `fn(uint8_t*, uint64_t)`.
+  // Records are passed in place, except in overwrite mode where they are
+  // copied out first since the producer may reclaim them at any time.
+  template <typename Fn>
+  size_t Drain(Fn &&fn, size_t max_records) {
+    size_t count = 0;
+    while (count < max_records) {
+      uint64_t tail = tail_.load(std::memory_order_acquire);
+      if (tail == head_.load(std::memory_order_acquire)) break;
+
+      const uint64_t header = LoadHeader(tail);
+      const uint64_t offset = tail & mask_;
+      if (header != Pad && (header > capacity_ || RecordSize(header) > capacity_ - offset)) continue;  // torn by an overwrite
+      const uint64_t next = tail + SpanAt(tail, header);
+
+      if (policy_ == Policy::Overwrite) {
+        if (header != Pad) scratch_.assign(&buffer_[offset + Header], &buffer_[offset + Header] + header);
+        if (!tail_.compare_exchange_strong(tail, next, std::memory_order_acq_rel)) continue;
+        if (header != Pad) {
+          fn(scratch_.data(), header);
+          count++;
+        }
+      } else {
+        if (header != Pad) {
+          fn(&buffer_[offset + Header], header);
+          count++;
+        }
+        tail_.store(next, std::memory_order_seq_cst);
+      }
+
+      if (producer_waiting_.load()) Wake(producer_wake_);
+    }
+
+    if (count) {
+      drained_.fetch_add(count, std::memory_order_relaxed);
+      batches_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return count;
+  }
+
+  // Blocks the consumer until there is something to drain. Returns false
+  // once the ring is closed and empty.
+  bool WaitForData() {
+    for (;;) {
+      if (tail_.load() != head_.load()) return true;
+      if (closed_.load()) return tail_.load() != head_.load();
+
+      uint32_t wake = consumer_wake_.load();
+      consumer_waiting_.store(true);
+      if (tail_.load() == head_.load() && !closed_.load()) consumer_wake_.wait(wake);
+      consumer_waiting_.store(false);
+    }
+  }
+
+  // When producer and consumer share a thread (lockstep), a full ring under 
+  // the block policy is drained in place instead of waiting for a consumer.
+  void SetDrainWhenFull(std::function<void()> drain) { drain_when_full_ = std::move(drain); }
+
+  // No more pushes are accepted; wakes both sides up.
+  void Close() {
+    closed_.store(true);
+    Wake(consumer_wake_);
+    Wake(producer_wake_);
+  }
+
+  Stats GetStats() const {
+    Stats stats;
+    stats.capacity = capacity_;
+    stats.pushed = pushed_.load();
+    stats.pushed_bytes = pushed_bytes_.load();
+    stats.drained = drained_.load();
+    stats.batches = batches_.load();
+    stats.dropped = dropped_.load();
+    stats.overwritten = overwritten_.load();
+    stats.high_water = high_water_.load();
+    return stats;
+  }
+
+  // C view handed to CPU modules through `attach_gpu_queue`. With several 
+  // CPU cores pushing, producers take turns on a lock; the drain side 
+  // stays lock-free.
+  tinyw_gpu_queue AsQueue(bool shared_producers = false) {
+    if (shared_producers) return tinyw_gpu_queue{
+      .ctx = this,
+      .push = [](void *ctx, const uint8_t *bytes, uint64_t len) -> int32_t {
+        auto *ring = static_cast<CommandRing*>(ctx);
+        std::lock_guard<std::mutex> lock(ring->producer_lock_);
+        return ring->Push(bytes, len);
+      },
+    };
+
+    return tinyw_gpu_queue{
+      .ctx = this,
+      .push = [](void *ctx, const uint8_t *bytes, uint64_t len) -> int32_t {
+        return static_cast<CommandRing*>(ctx)->Push(bytes, len);
+      },
+    };
+  }
+};
+
+TinyWDeclEnd
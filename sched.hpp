@@ -0,0 +1,241 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iomanip>
+#include <ostream>
+#include <exception>
+#include <condition_variable>
+
+#include "glob.hpp"
+#include "core.hpp"
+
+TinyWDeclStart
+
+// Runs many VMs over a fixed set of worker threads, one `Core::RunFor`
+// quantum at a time. Each worker owns a queue of runnable VMs: it runs them
+// round-robin from the front and, once its queue is empty, steals from the
+// back of a busy worker's queue.
+class VMScheduler {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct VMStats {
+    std::string name;
+    uint64_t cycles = 0;
+    uint64_t quanta = 0;
+    uint64_t migrations = 0;       // quanta run on another worker than the previous one
+    Clock::duration run_time{};    // inside RunFor
+    Clock::duration wait_time{};   // runnable, but queued
+    Clock::duration lifetime{};    // from Run() to halt
+    std::string error;
+  };
+
+private:
+  struct VM {
+    Core *core = nullptr;
+    VMStats stats;
+    Clock::time_point ready_since;
+    size_t last_worker = SIZE_MAX;
+  };
+
+  struct Worker {
+    std::mutex lock;
+    std::deque<VM*> queue;
+    uint64_t steals = 0;
+    uint64_t quanta = 0;
+  };
+
+  uint64_t quantum_;
+  std::vector<std::unique_ptr<VM>> vms_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::atomic<size_t> remaining_{0};
+  std::atomic<size_t> queued_{0};   // VMs sitting in a worker queue
+  std::atomic<size_t> idle_{0};
+  std::mutex idle_lock_;
+  std::condition_variable idle_cv_;
+  Clock::duration wall_time_{};
+
+  VM *Pop(Worker &worker) {
+    std::lock_guard<std::mutex> lock(worker.lock);
+    if (worker.queue.empty()) return nullptr;
+    VM *vm = worker.queue.front();
+    worker.queue.pop_front();
+    queued_.fetch_sub(1);
+    return vm;
+  }
+
+  VM *Steal(size_t thief) {
+    for (size_t i = 1; i < workers_.size(); i++) {
+      auto &victim = *workers_[(thief + i) % workers_.size()];
+      std::lock_guard<std::mutex> lock(victim.lock);
+      if (victim.queue.empty()) continue;
+      VM *vm = victim.queue.back();
+      victim.queue.pop_back();
+      queued_.fetch_sub(1);
+      workers_[thief]->steals++;
+      return vm;
+    }
+    return nullptr;
+  }
+
+  // `queued_` goes up before `idle_` is read, and idle workers count
+  // themselves before checking `queued_`: one of the two always sees the
+  // other, so a wakeup is never lost.
+  void Push(Worker &worker, VM *vm) {
+    {
+      std::lock_guard<std::mutex> lock(worker.lock);
+      worker.queue.push_back(vm);
+    }
+    queued_.fetch_add(1);
+    if (idle_.load()) {
+      std::lock_guard<std::mutex> lock(idle_lock_);
+      idle_cv_.notify_one();
+    }
+  }
+
+  void Halt(VM *vm, Clock::time_point started) {
+    try {
+      vm->core->Shutdown();
+    } catch (const std::exception &e) {
+      if (vm->stats.error.empty()) vm->stats.error = e.what();
+    } catch (...) {
+      if (vm->stats.error.empty()) vm->stats.error = "unknown exception";
+    }
+    vm->stats.lifetime = Clock::now() - started;
+    if (remaining_.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> lock(idle_lock_);
+      idle_cv_.notify_all();
+    }
+  }
+
+  void WorkerLoop(size_t id, Clock::time_point started) {
+    auto &self = *workers_[id];
+    tracer().NameThread("vm worker " + std::to_string(id));
+    while (remaining_.load() > 0) {
+      VM *vm = Pop(self);
+      if (!vm) vm = Steal(id);
+      if (!vm) {
+        // Fewer runnable VMs than workers: sleep until one is queued.
+        std::unique_lock<std::mutex> lock(idle_lock_);
+        idle_.fetch_add(1);
+        idle_cv_.wait(lock, [this] { return queued_.load() > 0 || remaining_.load() == 0; });
+        idle_.fetch_sub(1);
+        continue;
+      }
+
+      auto begin = Clock::now();
+      vm->stats.wait_time += begin - vm->ready_since;
+      if (vm->last_worker != SIZE_MAX && vm->last_worker != id) vm->stats.migrations++;
+      vm->last_worker = id;
+
+      uint64_t used;
+      try {
+        used = vm->core->RunFor(quantum_);
+      } catch (const std::exception &e) {
+        vm->stats.error = e.what();
+        used = TINYW_STEP_HALTED;
+      } catch (...) {
+        vm->stats.error = "unknown exception";
+        used = TINYW_STEP_HALTED;
+      }
+
+      auto end = Clock::now();
+      vm->stats.run_time += end - begin;
+      vm->stats.quanta++;
+      self.quanta++;
+
+      if (used == TINYW_STEP_HALTED) {
+        Halt(vm, started);
+        continue;
+      }
+
+      vm->stats.cycles += used;
+      vm->ready_since = end;
+      Push(self, vm);
+    }
+  }
+
+public:
+  VMScheduler(size_t workers, uint64_t quantum) : quantum_(std::max<uint64_t>(1, quantum)) {
+    workers = std::max<size_t>(1, workers);
+    for (size_t i = 0; i < workers; i++) workers_.push_back(std::make_unique<Worker>());
+  }
+
+  // `core` must be loaded and able to `RunFor`; it is not owned.
+  void Add(const std::string &name, Core *core) {
+    core->EnterLockstep();
+    auto vm = std::make_unique<VM>();
+    vm->core = core;
+    vm->stats.name = name;
+    vms_.push_back(std::move(vm));
+  }
+
+  void Run() {
+    auto started = Clock::now();
+    remaining_ = vms_.size();
+    for (size_t i = 0; i < vms_.size(); i++) {
+      vms_[i]->ready_since = started;
+      workers_[i % workers_.size()]->queue.push_back(vms_[i].get());
+    }
+    queued_ = vms_.size();
+
+    std::vector<std::thread> threads;
+    for (size_t id = 0; id < workers_.size(); id++) threads.emplace_back([this, id, started] { WorkerLoop(id, started); });
+    for (auto &thread : threads) thread.join();
+    wall_time_ = Clock::now() - started;
+  }
+
+  std::vector<VMStats> GetStats() const {
+    std::vector<VMStats> stats;
+    for (const auto &vm : vms_) stats.push_back(vm->stats);
+    return stats;
+  }
+
+  // Per-VM table, then throughput and Jain's fairness index over the
+  // cycle rate each VM got while it was alive (1.0 = perfectly even).
+  void Report(std::ostream &out) const {
+    auto ms = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+    out << std::left << std::setw(24) << "> vm" << std::right
+        << std::setw(14) << "cycles" << std::setw(9) << "quanta" << std::setw(12) << "run ms"
+        << std::setw(12) << "wait ms" << std::setw(11) << "Mcyc/s" << std::setw(8) << "moves" << "\n";
+
+    double sum = 0, sum_sq = 0;
+    uint64_t total_cycles = 0;
+    for (const auto &vm : vms_) {
+      const auto &s = vm->stats;
+      double seconds = std::chrono::duration<double>(s.lifetime).count();
+      double rate = seconds > 0 ? s.cycles / seconds : 0;
+      sum += rate;
+      sum_sq += rate * rate;
+      total_cycles += s.cycles;
+
+      out << "> " << std::left << std::setw(22) << s.name << std::right << std::fixed << std::setprecision(1)
+          << std::setw(14) << s.cycles << std::setw(9) << s.quanta << std::setw(12) << ms(s.run_time)
+          << std::setw(12) << ms(s.wait_time) << std::setw(11) << rate / 1e6 << std::setw(8) << s.migrations;
+      if (!s.error.empty()) out << "  error: " << s.error;
+      out << "\n";
+    }
+
+    uint64_t steals = 0;
+    for (const auto &worker : workers_) steals += worker->steals;
+
+    double seconds = std::chrono::duration<double>(wall_time_).count();
+    double fairness = sum_sq > 0 ? sum * sum / (vms_.size() * sum_sq) : 1.0;
+    out << "> " << vms_.size() << " VMs on " << workers_.size() << " workers in " << std::setprecision(1) << ms(wall_time_)
+        << " ms: " << std::setprecision(2) << (seconds > 0 ? total_cycles / seconds / 1e6 : 0) << " Mcycles/s total, "
+        << steals << " steals, fairness " << std::setprecision(3) << fairness << std::endl;
+    out.unsetf(std::ios::floatfield);
+  }
+};
+
+TinyWDeclEnd
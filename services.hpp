@@ -0,0 +1,130 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <functional>
+
+#if defined(_WIN32)
+  #include <malloc.h>
+#endif
+
+#include "glob.hpp"
+
+TinyWDeclStart
+
+// Owner side of the `tinyw_host_services` table of one module. Each module
+// gets its own, so log lines carry the module's name and `fail` is charged
+// to it. The table must outlive the module.
+class HostServices {
+private:
+  std::string name_;
+  tinyw_host_services table_{};
+  uint32_t level_ = TINYW_LOG_INFO;
+  std::function<void()> on_fail_;
+  mutable std::mutex lock_;
+  std::string error_;
+
+  static std::mutex &LogLock() {
+    static std::mutex lock;
+    return lock;
+  }
+
+  static void Log(void *ctx, uint32_t level, const char *message) {
+    static const char *const names[] = { "debug", "info", "warn", "err" };
+    auto &self = *static_cast<HostServices*>(ctx);
+    if (level < self.level_ || !message) return;
+    std::lock_guard<std::mutex> lock(LogLock());
+    std::cerr << "> [" << self.name_ << ":" << names[std::min<uint32_t>(level, TINYW_LOG_ERROR)] << "]: " << message << std::endl;
+  }
+
+  // Only the first failure is kept: later ones are usually its fallout.
+  static void Fail(void *ctx, const char *message) {
+    auto &self = *static_cast<HostServices*>(ctx);
+    {
+      std::lock_guard<std::mutex> lock(self.lock_);
+      if (!self.error_.empty()) return;
+      self.error_ = message && *message ? message : "unspecified failure";
+    }
+    if (self.on_fail_) self.on_fail_();
+  }
+
+  static uint64_t MonotonicNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static void *Alloc(uint64_t size, uint64_t alignment) {
+    if (alignment == 0 || (alignment & (alignment - 1))) return nullptr;
+    alignment = std::max<uint64_t>(alignment, sizeof(void*));
+#if defined(_WIN32)
+    return _aligned_malloc(size ? size : 1, alignment);
+#else
+    void *ptr = nullptr;
+    return posix_memalign(&ptr, alignment, size ? size : 1) == 0 ? ptr : nullptr;
+#endif
+  }
+
+  static void Free(void *ptr) {
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+  }
+
+public:
+  explicit HostServices(const std::string &name) : name_(name) {}
+
+  HostServices(const HostServices&) = delete;
+  HostServices &operator=(const HostServices&) = delete;
+
+  static uint32_t ParseLogLevel(const std::string &level) {
+    auto l = to_lowercase(level);
+    if (l == "debug") return TINYW_LOG_DEBUG;
+    if (l == "info") return TINYW_LOG_INFO;
+    if (l == "warn") return TINYW_LOG_WARN;
+    if (l == "error" || l == "err") return TINYW_LOG_ERROR;
+    therr(func, "Unknown log level: `" + level + "` (expected debug, info, warn or error)");
+    return TINYW_LOG_INFO;
+  }
+
+  // `on_fail` runs once, on the thread of the first `fail`.
+  void Setup(uint32_t level, const tinyw_stop_token *stop, const tinyw_tracer *tracer, std::function<void()> on_fail) {
+    level_ = level;
+    on_fail_ = std::move(on_fail);
+    table_ = tinyw_host_services{
+      .version = TINYW_HOST_SERVICES_VERSION,
+      .size = sizeof(tinyw_host_services),
+      .capabilities = TINYW_HOST_CAP_LOG | TINYW_HOST_CAP_CLOCK | TINYW_HOST_CAP_ALLOC | TINYW_HOST_CAP_FAIL |
+                      (stop ? TINYW_HOST_CAP_STOP : 0) | (tracer ? TINYW_HOST_CAP_TRACE : 0),
+      .ctx = this,
+      .log = Log,
+      .monotonic_ns = MonotonicNs,
+      .alloc = Alloc,
+      .free = Free,
+      .stop = stop,
+      .tracer = tracer,
+      .fail = Fail,
+    };
+  }
+
+  const tinyw_host_services *Table() const { return &table_; }
+  const std::string &Name() const { return name_; }
+
+  // The message of the module's first `fail`, empty if it never failed.
+  std::string Error() const {
+    std::lock_guard<std::mutex> lock(lock_);
+    return error_;
+  }
+
+  // Turns a reported failure into the host's usual error.
+  void ThrowIfFailed() const {
+    auto error = Error();
+    if (!error.empty()) therr(func, name_ + " module failed: " + error);
+  }
+};
+
+TinyWDeclEnd
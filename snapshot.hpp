@@ -0,0 +1,530 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <filesystem>
+#include <condition_variable>
+
+#if defined(__linux__)
+  #include <fcntl.h>
+  #include <signal.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#include "glob.hpp"
+#include "mem.hpp"
+
+TinyWDeclStart
+
+// Guest RAM snapshots: `base.img` holds the RAM as it was when snapshots
+// were enabled, then every checkpoint adds a `delta-<seq>.twd` with only the
+// pages written since the previous one:
+//
+//   header (TinyWSnapshotDelta), uint64_t page_index[count], page data...
+//
+// Page data follows the index order, which is ascending.
+struct TinyWSnapshotDelta {
+  char     magic[8];
+  uint64_t sequence;
+  uint64_t page_size;
+  uint64_t ram_size;
+  uint64_t count;
+};
+
+#define TinyWSnapshotMagic "TWDELTA1"
+
+#if defined(__linux__)
+
+// Dirty pages from write faults: tracked pages are write-protected, the
+// first write to one faults, gets logged and unprotected. A checkpoint only
+// touches the pages in the log, so it costs O(pages written).
+class WriteFaultTracker {
+private:
+  static constexpr size_t MaxTrackers = 16;
+
+  static std::atomic<WriteFaultTracker*> *Slots() {
+    static std::atomic<WriteFaultTracker*> slots[MaxTrackers];
+    return slots;
+  }
+
+  static struct sigaction &Previous() {
+    static struct sigaction previous{};
+    return previous;
+  }
+
+  uint8_t *base_;
+  uint64_t size_, page_, pages_;
+  std::unique_ptr<std::atomic<uint64_t>[]> bits_;   // page is in the log
+  std::unique_ptr<std::atomic<uint64_t>[]> log_;    // page + 1, 0 while being written
+  std::atomic<uint64_t> head_{0};
+  uint64_t tail_ = 0;
+  size_t slot_ = MaxTrackers;
+
+  // Async-signal-safe: atomics and mprotect only. Each page sits in the log
+  // at most once, so the log never holds more than `pages_` entries. Only
+  // the thread that marks the page unprotects it, before publishing its log
+  // entry: `Take` waits for the entry, so its re-protection always comes
+  // last. A thread faulting on a page that is already marked just returns
+  // and retries the write.
+  void Record(uint8_t *addr) {
+    uint64_t page = (addr - base_) / page_;
+    uint64_t mask = uint64_t(1) << (page % 64);
+    if (bits_[page / 64].fetch_or(mask) & mask) return;
+    auto &entry = log_[head_.fetch_add(1) % pages_];
+    mprotect(base_ + page * page_, page_, PROT_READ | PROT_WRITE);
+    entry.store(page + 1, std::memory_order_release);
+  }
+
+  static void OnFault(int, siginfo_t *info, void *) {
+    auto *addr = static_cast<uint8_t*>(info->si_addr);
+    for (size_t i = 0; i < MaxTrackers; i++) {
+      auto *tracker = Slots()[i].load(std::memory_order_acquire);
+      if (tracker && addr >= tracker->base_ && addr < tracker->base_ + tracker->size_) {
+        tracker->Record(addr);
+        return;
+      }
+    }
+    // Not a tracked page: restore the previous handler, the access faults again.
+    sigaction(SIGSEGV, &Previous(), nullptr);
+  }
+
+public:
+  WriteFaultTracker(uint8_t *base, uint64_t size, uint64_t page)
+    : base_(base), size_(size), page_(page), pages_(size / page) {
+    bits_ = std::make_unique<std::atomic<uint64_t>[]>(pages_ / 64 + 1);
+    log_ = std::make_unique<std::atomic<uint64_t>[]>(pages_);
+
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+      struct sigaction action{};
+      action.sa_sigaction = OnFault;
+      action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+      sigemptyset(&action.sa_mask);
+      sigaction(SIGSEGV, &action, &Previous());
+    });
+
+    for (size_t i = 0; i < MaxTrackers && slot_ == MaxTrackers; i++) {
+      WriteFaultTracker *expected = nullptr;
+      if (Slots()[i].compare_exchange_strong(expected, this)) slot_ = i;
+    }
+    if (slot_ == MaxTrackers) therr(func, "Too many guest memories tracked at once");
+
+    if (mprotect(base_, size_, PROT_READ) != 0) therr(func, AnyString("Cannot write-protect guest memory: ") | strerror(errno));
+  }
+
+  ~WriteFaultTracker() {
+    mprotect(base_, size_, PROT_READ | PROT_WRITE);
+    Slots()[slot_].store(nullptr, std::memory_order_release);
+  }
+
+  WriteFaultTracker(const WriteFaultTracker&) = delete;
+  WriteFaultTracker &operator=(const WriteFaultTracker&) = delete;
+
+  // Pages written since the last call, write-protected again. A page is
+  // unmarked before being protected, so a write racing with the checkpoint
+  // is either in the copy taken after this returns or logged again.
+  std::vector<uint64_t> Take() {
+    std::vector<uint64_t> pages;
+    const uint64_t head = head_.load();
+    for (; tail_ < head; tail_++) {
+      auto &entry = log_[tail_ % pages_];
+      uint64_t value;
+      while ((value = entry.load(std::memory_order_acquire)) == 0) std::this_thread::yield();
+      entry.store(0, std::memory_order_relaxed);
+
+      uint64_t page = value - 1;
+      bits_[page / 64].fetch_and(~(uint64_t(1) << (page % 64)));
+      mprotect(base_ + page * page_, page_, PROT_READ);
+      pages.push_back(page);
+    }
+    std::sort(pages.begin(), pages.end());
+    return pages;
+  }
+};
+
+// Dirty pages from the kernel's soft-dirty bits (/proc/self/pagemap bit 55).
+// No faults while the guest runs, but each checkpoint scans one pagemap
+// entry per guest page and clears the bits of the whole process.
+class SoftDirtyTracker {
+private:
+  uint8_t *base_;
+  uint64_t pages_;
+  int pagemap_ = -1;
+
+  static bool ClearRefs() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = write(fd, "4", 1) == 1;
+    close(fd);
+    return ok;
+  }
+
+  // Kernels without CONFIG_MEM_SOFT_DIRTY accept clear_refs but never set
+  // the bit, so check that a write to a scratch page shows up.
+  bool Probe() {
+    const uint64_t page = sysconf(_SC_PAGESIZE);
+    void *map = mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return false;
+    auto *scratch = static_cast<volatile uint8_t*>(map);
+    scratch[0] = 1;
+
+    uint64_t entry = 0;
+    bool ok = ClearRefs();
+    scratch[0] = 2;
+    ok = ok && pread(pagemap_, &entry, 8, reinterpret_cast<uintptr_t>(map) / page * 8) == 8 && (entry & SoftDirtyBit);
+    munmap(map, page);
+    return ok;
+  }
+
+public:
+  static constexpr uint64_t SoftDirtyBit = uint64_t(1) << 55;
+
+  SoftDirtyTracker(uint8_t *base, uint64_t size) : base_(base) {
+    const uint64_t page = sysconf(_SC_PAGESIZE);
+    pages_ = size / page;
+    pagemap_ = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (pagemap_ < 0 || !Probe()) therr(func, "Soft-dirty tracking is not available on this kernel, use `-core snapshot-tracking mprotect`");
+    ClearRefs();
+  }
+
+  ~SoftDirtyTracker() { if (pagemap_ >= 0) close(pagemap_); }
+
+  SoftDirtyTracker(const SoftDirtyTracker&) = delete;
+  SoftDirtyTracker &operator=(const SoftDirtyTracker&) = delete;
+
+  std::vector<uint64_t> Take() {
+    const uint64_t page = sysconf(_SC_PAGESIZE);
+    const uint64_t first = reinterpret_cast<uintptr_t>(base_) / page;
+    std::vector<uint64_t> pages, entries(std::min<uint64_t>(pages_, 65536));
+
+    for (uint64_t done = 0; done < pages_;) {
+      uint64_t count = std::min<uint64_t>(entries.size(), pages_ - done);
+      ssize_t got = pread(pagemap_, entries.data(), count * 8, (first + done) * 8);
+      if (got != (ssize_t)(count * 8)) therr(func, AnyString("Cannot read /proc/self/pagemap: ") | strerror(errno));
+      for (uint64_t i = 0; i < count; i++) if (entries[i] & SoftDirtyBit) pages.push_back(done + i);
+      done += count;
+    }
+
+    ClearRefs();
+    return pages;
+  }
+};
+
+class Snapshotter {
+public:
+  enum class Tracking { WriteFaults, SoftDirty };
+
+  struct Stats {
+    uint64_t checkpoints = 0;
+    uint64_t pages = 0;
+    uint64_t bytes = 0;
+    std::chrono::nanoseconds last{};
+    std::chrono::nanoseconds total{};
+  };
+
+  // "auto" picks write faults: checkpoints then scale with pages written.
+  static Tracking ParseTracking(const std::string &value) {
+    auto v = to_lowercase(value);
+    if (v == "auto" || v == "mprotect") return Tracking::WriteFaults;
+    if (v == "soft-dirty") return Tracking::SoftDirty;
+    therr(func, "Unknown snapshot tracking: `" + value + "` (expected auto, mprotect or soft-dirty)");
+    return Tracking::WriteFaults;
+  }
+
+  static fs::path DeltaPath(const fs::path &dir, uint64_t sequence) {
+    char name[32];
+    snprintf(name, sizeof(name), "delta-%08llu.twd", (unsigned long long)sequence);
+    return dir / name;
+  }
+
+  static std::vector<fs::path> ListDeltas(const fs::path &dir) {
+    std::vector<fs::path> deltas;
+    std::error_code ec;
+    for (const auto &entry : fs::directory_iterator(dir, ec)) {
+      auto name = entry.path().filename().string();
+      if (name.starts_with("delta-") && name.ends_with(".twd")) deltas.push_back(entry.path());
+    }
+    std::sort(deltas.begin(), deltas.end());
+    return deltas;
+  }
+
+private:
+  fs::path dir_;
+  uint8_t *ram_;
+  uint64_t size_, page_;
+  uint64_t sequence_ = 0;
+  std::unique_ptr<WriteFaultTracker> faults_;
+  std::unique_ptr<SoftDirtyTracker> soft_;
+  std::mutex checkpoint_lock_;
+  Stats stats_;
+
+  std::thread periodic_;
+  std::mutex periodic_lock_;
+  std::condition_variable periodic_cv_;
+  bool periodic_done_ = false;
+  std::string periodic_error_;     // why background checkpoints stopped
+
+  static void WriteAll(int fd, const void *data, uint64_t len, const fs::path &file) {
+    auto *bytes = static_cast<const uint8_t*>(data);
+    while (len) {
+      ssize_t n = write(fd, bytes, std::min<uint64_t>(len, TinyWCopyChunk));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) therr(func, AnyString("Cannot write `") | file.string() | "`: " | strerror(errno));
+      bytes += n;
+      len -= n;
+    }
+  }
+
+  static void ReadAll(int fd, void *data, uint64_t len, uint64_t offset, const fs::path &file) {
+    auto *bytes = static_cast<uint8_t*>(data);
+    while (len) {
+      ssize_t n = pread(fd, bytes, std::min<uint64_t>(len, TinyWCopyChunk), offset);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) therr(func, AnyString("Cannot read `") | file.string() | "`: " | strerror(errno));
+      bytes += n;
+      offset += n;
+      len -= n;
+    }
+  }
+
+  // Zero pages are left as holes: a mostly untouched guest costs no disk.
+  void WriteBase() {
+    auto file = dir_ / "base.img", tmp = dir_ / "base.img.tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) therr(func, AnyString("Cannot create `") | tmp.string() | "`: " | strerror(errno));
+    std::unique_ptr<int, void(*)(int*)> guard(&fd, [](int *fd) { close(*fd); });
+
+    if (ftruncate(fd, size_) != 0) therr(func, AnyString("Cannot size `") | tmp.string() | "`: " | strerror(errno));
+    static const std::vector<uint8_t> zero(4096, 0);
+    for (uint64_t offset = 0; offset < size_; offset += zero.size()) {
+      const uint64_t len = std::min<uint64_t>(zero.size(), size_ - offset);
+      if (memcmp(ram_ + offset, zero.data(), len) == 0) continue;
+      if (lseek(fd, offset, SEEK_SET) < 0) therr(func, AnyString("Cannot seek in `") | tmp.string() | "`");
+      WriteAll(fd, ram_ + offset, len, tmp);
+    }
+
+    guard.reset();
+    fs::rename(tmp, file);
+  }
+
+  // Writes `pages` (ascending) as one delta, coalescing contiguous runs.
+  void WriteDelta(const std::vector<uint64_t> &pages) {
+    auto file = DeltaPath(dir_, ++sequence_);
+    auto tmp = file;
+    tmp += ".tmp";
+
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) therr(func, AnyString("Cannot create `") | tmp.string() | "`: " | strerror(errno));
+    std::unique_ptr<int, void(*)(int*)> guard(&fd, [](int *fd) { close(*fd); });
+
+    TinyWSnapshotDelta header{};
+    memcpy(header.magic, TinyWSnapshotMagic, sizeof(header.magic));
+    header.sequence = sequence_;
+    header.page_size = page_;
+    header.ram_size = size_;
+    header.count = pages.size();
+    WriteAll(fd, &header, sizeof(header), tmp);
+    WriteAll(fd, pages.data(), pages.size() * sizeof(uint64_t), tmp);
+
+    for (size_t i = 0; i < pages.size();) {
+      size_t j = i + 1;
+      while (j < pages.size() && pages[j] == pages[j - 1] + 1) j++;
+      WriteAll(fd, ram_ + pages[i] * page_, (j - i) * page_, tmp);
+      i = j;
+    }
+
+    guard.reset();
+    fs::rename(tmp, file);
+  }
+
+public:
+  // Starts tracking `ram`. Unless `resume`, any previous snapshot in `dir`
+  // is replaced by a new base image; otherwise deltas continue its sequence.
+  Snapshotter(const fs::path &dir, const GuestRAM &ram, Tracking tracking, bool resume)
+    : dir_(dir), ram_(ram.Data()), size_(ram.Size()) {
+    fs::create_directories(dir_);
+
+    if (tracking == Tracking::SoftDirty) {
+      if (ram.Backing() == "hugetlb") therr(func, "Soft-dirty tracking does not support hugetlb-backed guest memory");
+      page_ = sysconf(_SC_PAGESIZE);
+    } else {
+      // hugetlb can only be protected a whole huge page at a time.
+      page_ = ram.Backing() == "hugetlb" ? ram.PageSize() : sysconf(_SC_PAGESIZE);
+    }
+
+    auto deltas = ListDeltas(dir_);
+    if (resume && fs::exists(dir_ / "base.img")) {
+      sequence_ = deltas.size();
+    } else {
+      for (const auto &delta : deltas) fs::remove(delta);
+      WriteBase();
+    }
+
+    if (tracking == Tracking::SoftDirty) soft_ = std::make_unique<SoftDirtyTracker>(ram_, size_);
+    else faults_ = std::make_unique<WriteFaultTracker>(ram_, size_, page_);
+  }
+
+  ~Snapshotter() {
+    StopPeriodic();
+  }
+
+  Snapshotter(const Snapshotter&) = delete;
+  Snapshotter &operator=(const Snapshotter&) = delete;
+
+  // Writes the pages dirtied since the previous checkpoint. Exact when the
+  // guest is paused (lockstep, end of run); taken while it runs, every page
+  // is consistent with itself and later writes land in the next delta.
+  void Checkpoint() {
+    std::lock_guard<std::mutex> lock(checkpoint_lock_);
+    auto begin = std::chrono::steady_clock::now();
+
+    auto pages = faults_ ? faults_->Take() : soft_->Take();
+    WriteDelta(pages);
+
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    stats_.checkpoints++;
+    stats_.pages += pages.size();
+    stats_.bytes += pages.size() * page_;
+    stats_.last = elapsed;
+    stats_.total += elapsed;
+  }
+
+  // Background checkpoints while the VM runs free (threaded scheduler). 
+  // The first failure stops them and is kept for `PeriodicError`: the VM
+  // itself keeps running.
+  void StartPeriodic(std::chrono::nanoseconds interval) {
+    periodic_ = std::thread([this, interval] {
+      std::unique_lock<std::mutex> lock(periodic_lock_);
+      while (!periodic_cv_.wait_for(lock, interval, [this] { return periodic_done_; })) {
+        lock.unlock();
+        std::string error;
+        try {
+          Checkpoint();
+        } catch (const std::exception &e) {
+          error = e.what();
+        } catch (...) {
+          error = "unknown exception";
+        }
+        lock.lock();
+        if (!error.empty()) {
+          periodic_error_ = error;
+          return;
+        }
+      }
+    });
+  }
+
+  void StopPeriodic() {
+    {
+      std::lock_guard<std::mutex> lock(periodic_lock_);
+      periodic_done_ = true;
+    }
+    periodic_cv_.notify_all();
+    if (periodic_.joinable()) periodic_.join();
+  }
+
+  // Stops tracking; must happen before the guest memory is unmapped.
+  void Stop() {
+    StopPeriodic();
+    faults_.reset();
+    soft_.reset();
+  }
+
+  // Empty unless a background checkpoint failed; the pages it took are 
+  // then missing from the snapshot.
+  std::string PeriodicError() {
+    std::lock_guard<std::mutex> lock(periodic_lock_);
+    return periodic_error_;
+  }
+
+  Stats GetStats() const { return stats_; }
+  uint64_t PageSize() const { return page_; }
+
+  // Reads `dir`/base.img into `ram` and applies every delta in order.
+  // Returns the number of deltas applied. `ram` keeps its mapping, so its
+  // huge page advice and NUMA binding still hold.
+  static uint64_t Restore(const fs::path &dir, GuestRAM &ram) {
+    auto base = dir / "base.img";
+    int fd = open(base.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) therr(func, AnyString("Cannot open snapshot `") | base.string() | "`: " | strerror(errno));
+    std::unique_ptr<int, void(*)(int*)> guard(&fd, [](int *fd) { close(*fd); });
+
+    struct stat st{};
+    fstat(fd, &st);
+    if ((uint64_t)st.st_size != ram.Size())
+      therr(func, AnyString("Snapshot `") | base.string() | "` holds " | format_size(st.st_size) |
+                  " of guest memory, but " | format_size(ram.Size()) | " are allocated (-mem size)");
+
+    ReadAll(fd, ram.Data(), ram.Size(), 0, base);
+
+    auto deltas = ListDeltas(dir);
+    for (const auto &delta : deltas) {
+      int dfd = open(delta.c_str(), O_RDONLY | O_CLOEXEC);
+      if (dfd < 0) therr(func, AnyString("Cannot open `") | delta.string() | "`: " | strerror(errno));
+      std::unique_ptr<int, void(*)(int*)> dguard(&dfd, [](int *fd) { close(*fd); });
+
+      struct stat dst{};
+      fstat(dfd, &dst);
+      TinyWSnapshotDelta header{};
+      ReadAll(dfd, &header, sizeof(header), 0, delta);
+      if (memcmp(header.magic, TinyWSnapshotMagic, sizeof(header.magic)) != 0 || header.ram_size != ram.Size() ||
+          !header.page_size || header.page_size > ram.Size())
+        therr(func, "Invalid or mismatched snapshot delta: " + delta.string());
+
+      // Headers come from disk: bound everything before allocating or writing.
+      const uint64_t ram_pages = ram.Size() / header.page_size;
+      const uint64_t file_size = (uint64_t)dst.st_size > sizeof(header) ? dst.st_size - sizeof(header) : 0;
+      if (header.count > ram_pages || header.count > file_size / sizeof(uint64_t))
+        therr(func, "Snapshot delta out of range: " + delta.string());
+
+      std::vector<uint64_t> pages(header.count);
+      ReadAll(dfd, pages.data(), pages.size() * sizeof(uint64_t), sizeof(header), delta);
+
+      uint64_t offset = sizeof(header) + pages.size() * sizeof(uint64_t);
+      for (size_t i = 0; i < pages.size();) {
+        size_t j = i + 1;
+        while (j < pages.size() && pages[j] == pages[j - 1] + 1) j++;
+        const uint64_t len = (j - i) * header.page_size;
+        if (pages[i] >= ram_pages || j - i > ram_pages - pages[i]) therr(func, "Snapshot delta out of range: " + delta.string());
+        ReadAll(dfd, ram.Data() + pages[i] * header.page_size, len, offset, delta);
+        offset += len;
+        i = j;
+      }
+    }
+    return deltas.size();
+  }
+};
+
+#else
+
+class Snapshotter {
+public:
+  enum class Tracking { WriteFaults, SoftDirty };
+  struct Stats { uint64_t checkpoints = 0, pages = 0, bytes = 0; std::chrono::nanoseconds last{}, total{}; };
+
+  static Tracking ParseTracking(const std::string&) { return Tracking::WriteFaults; }
+  Snapshotter(const fs::path&, const GuestRAM&, Tracking, bool) { therr(func, "Snapshots are only supported on Linux"); }
+  void Checkpoint() {}
+  void StartPeriodic(std::chrono::nanoseconds) {}
+  void StopPeriodic() {}
+  std::string PeriodicError() { return ""; }
+  void Stop() {}
+  Stats GetStats() const { return {}; }
+  uint64_t PageSize() const { return 0; }
+  static uint64_t Restore(const fs::path&, GuestRAM&) { therr(func, "Snapshots are only supported on Linux"); return 0; }
+};
+
+#endif
+
+TinyWDeclEnd
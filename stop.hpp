@@ -0,0 +1,161 @@
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <functional>
+#include <condition_variable>
+
+#if defined(__linux__)
+  #include <unistd.h>
+  #include <sys/eventfd.h>
+#endif
+
+#if !defined(_WIN32)
+  #include <time.h>
+#endif
+
+#include "glob.hpp"
+
+TinyWDeclStart
+
+// Owner side of the `tinyw_stop_token` handed to every module: one flag
+// modules can poll for free, plus an eventfd for modules that sleep in
+// poll()/epoll() and need to be woken up.
+class StopSource {
+private:
+  alignas(std::atomic_ref<uint32_t>::required_alignment) uint32_t flag_ = 0;
+  int32_t event_fd_ = -1;
+  tinyw_stop_token token_{};
+
+public:
+  StopSource() {
+#if defined(__linux__)
+    event_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#endif
+    token_ = tinyw_stop_token{ .flag = &flag_, .event_fd = event_fd_ };
+  }
+
+  ~StopSource() {
+#if defined(__linux__)
+    if (event_fd_ >= 0) close(event_fd_);
+#endif
+  }
+
+  StopSource(const StopSource&) = delete;
+  StopSource &operator=(const StopSource&) = delete;
+
+  // Returns true for the call that actually flipped the flag.
+  bool RequestStop() {
+    if (std::atomic_ref<uint32_t>(flag_).exchange(1) != 0) return false;
+#if defined(__linux__)
+    if (event_fd_ >= 0) {
+      uint64_t one = 1;
+      (void)!write(event_fd_, &one, sizeof(one));
+    }
+#endif
+    return true;
+  }
+
+  bool StopRequested() const {
+    return std::atomic_ref<uint32_t>(const_cast<uint32_t&>(flag_)).load(std::memory_order_relaxed) != 0;
+  }
+
+  const tinyw_stop_token *Token() const { return &token_; }
+};
+
+// Enforces the wall-clock and CPU-time budgets of a run from its own thread.
+// It sleeps until the next deadline could possibly be reached, so it costs
+// a handful of wake-ups per run rather than a polling loop.
+class Watchdog {
+private:
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool done_ = false;
+  std::string expired_;
+
+  static std::chrono::nanoseconds ProcessCPUTime() {
+#if defined(_WIN32)
+    return std::chrono::nanoseconds(0);
+#else
+    timespec ts{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+#endif
+  }
+
+public:
+  typedef std::chrono::nanoseconds Limit;
+
+  // A zero limit is disabled. `on_limit` receives a description of what
+  // expired and should request a stop; if the run still has not finished
+  // after `grace`, the process exits with status 124 (as timeout(1) does).
+  void Start(Limit wall_limit, Limit cpu_limit, Limit grace, std::function<void(const std::string&)> on_limit) {
+    if (wall_limit.count() == 0 && cpu_limit.count() == 0) return;
+
+    thread_ = std::thread([=, this] {
+      const auto started = std::chrono::steady_clock::now();
+      const auto cpu_started = ProcessCPUTime();
+      const auto cores = std::max<unsigned>(1, std::thread::hardware_concurrency());
+      std::string expired;
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!done_ && expired.empty()) {
+        auto now = std::chrono::steady_clock::now();
+        auto next = now + std::chrono::hours(24);
+
+        if (wall_limit.count()) {
+          if (now - started >= wall_limit) expired = "wall-clock limit (-core timeout)";
+          next = std::min(next, started + wall_limit);
+        }
+
+        if (cpu_limit.count() && expired.empty()) {
+          auto used = ProcessCPUTime() - cpu_started;
+          if (used >= cpu_limit) expired = "CPU-time limit (-core cpu-limit)";
+          // CPU time grows at most `cores` times faster than wall time.
+          auto earliest = std::max<Limit>((cpu_limit - used) / cores, std::chrono::milliseconds(1));
+          next = std::min(next, now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(earliest));
+        }
+
+        if (expired.empty()) cv_.wait_until(lock, next, [this] { return done_; });
+      }
+
+      if (done_) return;
+
+      expired_ = expired;
+      lock.unlock();
+      on_limit(expired);
+      lock.lock();
+
+      if (!cv_.wait_for(lock, grace, [this] { return done_; })) {
+        std::cerr << "\n> [i:err]: VM did not stop within "
+                  << std::chrono::duration<double>(grace).count() << "s of the " << expired
+                  << ", exiting" << std::endl;
+        std::_Exit(124);
+      }
+    });
+  }
+
+  void Finish() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+  }
+
+  // Which limit stopped the run, empty if none did. Valid after Finish().
+  const std::string &Expired() const { return expired_; }
+
+  ~Watchdog() { Finish(); }
+};
+
+TinyWDeclEnd
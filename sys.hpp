@@ -1,5 +1,7 @@
 #pragma once
 
+#include <mutex>
+#include <chrono>
 #include <vector>
 #include <memory>
 #include <string>
@@ -42,12 +44,52 @@
 
 TinyWDeclStart
 
+// Modules linked into the tinyw binary itself, opened as `builtin:<name>` 
+// wherever a module file is expected. A builtin module is what a loaded 
+// library would be: a table of exported symbols.
+#define TinyWBuiltinPrefix "builtin:"
+
+struct BuiltinModule {
+  std::string kind;           // "cpu", "gpu" or "memory"
+  std::string description;
+  std::unordered_map<std::string, void*> symbols;
+  bool linked = false;        // a module source built with TINYW_STATIC_MODULE
+};
+
+inline std::map<std::string, BuiltinModule> &builtin_modules() {
+  static std::map<std::string, BuiltinModule> modules;
+  return modules;
+}
+
+// Returns false if `name` was already taken.
+inline bool register_builtin_module(const std::string &name, BuiltinModule module) {
+  return builtin_modules().emplace(name, std::move(module)).second;
+}
+
+inline bool is_builtin_module(const fs::path &path) { return path.string().starts_with(TinyWBuiltinPrefix); }
+
+// `builtin:<name>` if `path` names a module that was linked in statically
+// (`dir/libname.so`, `name.so` or `name`), else `path` unchanged.
+inline fs::path prefer_static_module(const fs::path &path) {
+  if (path.empty() || is_builtin_module(path)) return path;
+  auto name = path.filename().string();
+  if (name.ends_with(LIB_EXTENTION)) name.resize(name.size() - std::string(LIB_EXTENTION).size());
+  for (auto candidate : { name, name.starts_with("lib") ? name.substr(3) : std::string() }) {
+    auto it = builtin_modules().find(candidate);
+    if (!candidate.empty() && it != builtin_modules().end() && it->second.linked) return TinyWBuiltinPrefix + candidate;
+  }
+  return path;
+}
+
 class DynamicLibrary {
   LIB_HANDLE handle_ = nullptr;
+  const BuiltinModule *builtin_ = nullptr;
   std::string loaded_name_;
+  std::string error_;
 
 public:
   static std::string BuildLibName(const std::string &base) {
+    if (is_builtin_module(base)) return base;
 
     if (!base.ends_with(LIB_EXTENTION)) {
 #if defined(_WIN32)
@@ -66,17 +108,35 @@ public:
     Close();
     std::string lib_name = BuildLibName(base_name);
     if (lib_name.empty()) return false;
+
+    if (is_builtin_module(lib_name)) {
+      auto it = builtin_modules().find(lib_name.substr(sizeof(TinyWBuiltinPrefix) - 1));
+      if (it == builtin_modules().end()) {
+        error_ = "No builtin module named `" + lib_name + "`";
+        return false;
+      }
+      builtin_ = &it->second;
+      loaded_name_ = lib_name;
+      return true;
+    }
+
     handle_ = LOAD_LIBRARY(lib_name.c_str());
     if (handle_) loaded_name_ = lib_name;
     return handle_ != nullptr;
   }
 
   void* GetSymbol(const std::string& symbol) {
+    if (builtin_) {
+      auto it = builtin_->symbols.find(symbol);
+      return it == builtin_->symbols.end() ? nullptr : it->second;
+    }
     if (!handle_) return nullptr;
     return (void*)GET_PROC_ADDR(handle_, symbol.c_str());
   }
 
   void Close() {
+    builtin_ = nullptr;
+    error_.clear();
     if (handle_) {
       CLOSE_LIBRARY(handle_);
       handle_ = nullptr;
@@ -84,10 +144,20 @@ public:
     }
   }
 
+  // Calls the optional `void symbol(const T*)` entry point, if exported.
+  template <typename T>
+  bool Attach(const std::string &symbol, const T *arg) {
+    auto fn = (void(*)(const T*))GetSymbol(symbol);
+    if (!fn || !arg) return false;
+    fn(arg);
+    return true;
+  }
+
   std::string Name() const { return loaded_name_; }
-  bool IsOpen() const { return handle_ != nullptr; }
+  bool IsOpen() const { return handle_ != nullptr || builtin_ != nullptr; }
 
   std::string Error() {
+    if (!error_.empty()) return error_;
     #if defined(_WIN32)
       DWORD errorMessageID = ::GetLastError();
       if (errorMessageID == 0)
@@ -110,6 +180,30 @@ public:
 
   DynamicLibrary(const fs::path &path) { Open(path); }
 
+  // Owns the handle: copies would `dlclose` it twice.
+  DynamicLibrary(const DynamicLibrary&) = delete;
+  DynamicLibrary &operator=(const DynamicLibrary&) = delete;
+
+  DynamicLibrary(DynamicLibrary &&other) noexcept 
+    : handle_(other.handle_), builtin_(other.builtin_), loaded_name_(std::move(other.loaded_name_)), 
+      error_(std::move(other.error_)) {
+    other.handle_ = nullptr;
+    other.builtin_ = nullptr;
+  }
+
+  DynamicLibrary &operator=(DynamicLibrary &&other) noexcept {
+    if (this != &other) {
+      Close();
+      handle_ = other.handle_;
+      builtin_ = other.builtin_;
+      loaded_name_ = std::move(other.loaded_name_);
+      error_ = std::move(other.error_);
+      other.handle_ = nullptr;
+      other.builtin_ = nullptr;
+    }
+    return *this;
+  }
+
   ~DynamicLibrary() { Close(); }
 
   typedef struct {
@@ -118,17 +212,142 @@ public:
     fs::path Path;
   } OpenStatus;
 
+  // A library is loaded once per process and shared by every VM using it.
+  static std::shared_ptr<DynamicLibrary> Shared(const fs::path &path) {
+    static std::mutex lock;
+    static std::unordered_map<std::string, std::weak_ptr<DynamicLibrary>> loaded;
+
+    auto name = BuildLibName(path.string());
+    std::error_code ec;
+    auto key = is_builtin_module(name) ? name : fs::weakly_canonical(name, ec).string();
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (auto lib = loaded[key].lock()) return lib;
+
+    auto lib = std::make_shared<DynamicLibrary>();
+    if (lib->Open(name)) loaded[key] = lib;
+    return lib;
+  }
+
   static OpenStatus TestLib(const fs::path &lib) {
     DynamicLibrary tester(lib);
     
     return OpenStatus {
       .IsOpen = tester.IsOpen(), 
       .Error  = tester.Error(), 
-      .Path = fs::absolute(lib)
+      .Path = is_builtin_module(lib) ? lib : fs::absolute(lib)
     };
   }
 };
 
+// One VM's use of a module library. The library is shared by all VMs that 
+// load the same file; instance-aware modules (`create_instance`) also get a 
+// handle of their own per VM, which every `_i` entry point takes.
+class ModuleInstance {
+  std::shared_ptr<DynamicLibrary> lib_;
+  tinyw_instance instance_ = nullptr;
+  Tfunc_DestroyInstance destroy_ = nullptr;
+
+public:
+  bool Open(const fs::path &path) {
+    Close();
+    lib_ = DynamicLibrary::Shared(path);
+    if (!lib_->IsOpen()) return false;
+
+    auto create = (Tfunc_CreateInstance)lib_->GetSymbol("create_instance");
+    destroy_ = (Tfunc_DestroyInstance)lib_->GetSymbol("destroy_instance");
+    if (!create || !destroy_) {
+      destroy_ = nullptr;
+      return true;
+    }
+
+    instance_ = create();
+    if (!instance_) therr(func, "`create_instance` of " + path.string() + " returned a null handle");
+    return true;
+  }
+
+  void Close() {
+    if (destroy_) destroy_(instance_);
+    instance_ = nullptr;
+    destroy_ = nullptr;
+    lib_.reset();
+  }
+
+  bool IsInstance() const { return destroy_ != nullptr; }
+
+  // Whether the library at `path` is instance-aware, without creating an 
+  // instance (or initialising it).
+  static bool IsInstanceLibrary(const fs::path &path) {
+    auto lib = DynamicLibrary::Shared(path);
+    return lib->IsOpen() && lib->GetSymbol("create_instance") && lib->GetSymbol("destroy_instance");
+  }
+  tinyw_instance Handle() const { return instance_; }
+  void *GetSymbol(const std::string &symbol) { return lib_ ? lib_->GetSymbol(symbol) : nullptr; }
+  std::string Error() { return lib_ ? lib_->Error() : ""; }
+
+  // Offers an optional resource: `symbol` for plain modules, `attach_i` 
+  // with `kind` (TINYW_ATTACH_*) for instance modules.
+  template <typename T>
+  bool Attach(const std::string &symbol, uint32_t kind, const T *resource) {
+    if (!resource || !lib_) return false;
+    if (!IsInstance()) return lib_->Attach(symbol, resource);
+    auto attach = (Tfunc_AttachInstance)lib_->GetSymbol("attach_i");
+    return attach && attach(instance_, kind, resource);
+  }
+
+  ModuleInstance() = default;
+  ModuleInstance(const ModuleInstance&) = delete;
+  ModuleInstance &operator=(const ModuleInstance&) = delete;
+  ~ModuleInstance() { Close(); }
+};
+
+// An entry point of either ABI: `name` on plain modules, `name_i` (taking 
+// the instance handle first) on instance modules. Called like the plain one.
+template <typename Fn> class ModuleEntry;
+
+template <typename R, typename... Args>
+class ModuleEntry<R(*)(Args...)> {
+  R (*plain_)(Args...) = nullptr;
+  R (*instance_)(tinyw_instance, Args...) = nullptr;
+  tinyw_instance self_ = nullptr;
+
+public:
+  // An empty `instance_name` means the entry point has no instance variant.
+  void Bind(ModuleInstance &module, const std::string &name, const std::string &instance_name) {
+    plain_ = nullptr;
+    instance_ = nullptr;
+    self_ = module.Handle();
+    if (!module.IsInstance()) plain_ = (R(*)(Args...))module.GetSymbol(name);
+    else if (!instance_name.empty()) instance_ = (R(*)(tinyw_instance, Args...))module.GetSymbol(instance_name);
+  }
+
+  void Bind(ModuleInstance &module, const std::string &name) { Bind(module, name, name + "_i"); }
+
+  explicit operator bool() const { return plain_ || instance_; }
+
+  // The plain function pointer, null for instance modules.
+  auto Plain() const { return plain_; }
+
+  R operator()(Args... args) const { return instance_ ? instance_(self_, args...) : plain_(args...); }
+};
+
+// Optional host resources offered to a module right before its `init`; 
+// each is only handed over if the module exports the matching symbol.
+struct ModuleAttachments {
+  const tinyw_gpu_queue   *gpu_queue   = nullptr;  // attach_gpu_queue
+  const tinyw_framebuffer *framebuffer = nullptr;  // attach_framebuffer
+  const tinyw_stop_token  *stop        = nullptr;  // attach_stop_token
+  const tinyw_smp         *smp         = nullptr;  // attach_smp
+  const tinyw_tracer      *tracer      = nullptr;  // attach_tracer
+  const tinyw_host_services *host      = nullptr;  // attach_host
+};
+
+// Where a module's setup went, filled in by the CPU, GPU and Memory wrappers.
+struct ModuleTimings {
+  std::chrono::steady_clock::duration open{};   // loading the library (and `create_instance`)
+  std::chrono::steady_clock::duration init{};   // the module's `init`
+};
+
 typedef struct {
   fs::path       path;
   DynamicLibrary lib;
@@ -141,6 +360,54 @@ struct ExtentionObject {
 
 typedef void(*ExtentionFunc)();
 
+// Bump whenever the directory layout of ~/.tinyw changes.
+#define TinyWHomeLayoutVersion 1
+
+// ~/.tinyw/settings/manifest: what the last provisioning installed, so a 
+// warm launch only has to compare it against the running executable.
+struct HomeManifest {
+  uint32_t layout = 0;
+  uintmax_t exec_size = 0;
+  int64_t exec_mtime = 0;
+  std::unordered_map<std::string, uint64_t> files{};  // relative path -> content hash
+
+  static bool Load(const fs::path &path, HomeManifest &out) {
+    std::ifstream in(path);
+    std::string magic, key;
+    if (!(in >> magic) || magic != "tinyw-manifest") return false;
+
+    while (in >> key) {
+      if (key == "layout") in >> out.layout;
+      else if (key == "exec-size") in >> out.exec_size;
+      else if (key == "exec-mtime") in >> out.exec_mtime;
+      else if (key == "file") {
+        std::string name;
+        uint64_t hash;
+        in >> name >> std::hex >> hash >> std::dec;
+        out.files[name] = hash;
+      } else return false;
+    }
+    return true;
+  }
+
+  void Save(const fs::path &path) const {
+    std::stringstream ss;
+    ss << "tinyw-manifest\n"
+       << "layout " << layout << "\n"
+       << "exec-size " << exec_size << "\n"
+       << "exec-mtime " << exec_mtime << "\n";
+    for (const auto &[name, hash] : files) 
+      ss << "file " << name << " " << std::hex << hash << std::dec << "\n";
+    auto str = ss.str();
+    write_file_atomic(path, str.data(), str.size());
+  }
+
+  bool Has(const std::string &name, uint64_t hash) const {
+    auto it = files.find(name);
+    return it != files.end() && it->second == hash;
+  }
+};
+
 class System {
 private:
   static std::vector<std::filesystem::path> GetFoldersToCreate() {
@@ -155,6 +422,139 @@ private:
     };
   }
 
+  static std::unordered_map<std::string, int> &SubCommands() {
+    static std::unordered_map<std::string, int> out;
+    return out;
+  }
+
+  static std::unordered_map<std::string, ExtentionObject> &Extentions() {
+    static std::unordered_map<std::string, ExtentionObject> extens;
+    return extens;
+  }
+
+  static GenericTask ScanExtentionsTask(const fs::path &home) {
+    return GenericTask("launch extentions", [home](auto report_progress){
+      auto &extens = Extentions();
+      auto entries = GetEntries(home / "extentions/");
+      extens.clear();
+
+      for (size_t i = 0; i < entries.size(); i++) {
+        auto path = entries[i];
+
+        if (fs::exists(path)) {
+          extens[path.filename().string()].path = path;
+        }
+        
+        report_progress((float)(i) / entries.size());
+      }
+
+      report_progress(1.0f);
+    });
+  }
+
+  static GenericTask LoadExtentionsTask(size_t &loaded, size_t &opened) {
+    return GenericTask("loading extentions", [&loaded, &opened](auto report_progress){
+      auto &extentions = Extentions();
+      size_t done = 0;
+      for (auto &key:extentions) {
+        key.second.lib.Open(key.second.path);
+        if (key.second.lib.IsOpen()) {
+          ExtentionFunc fh = (ExtentionFunc)key.second.lib.GetSymbol("entry");
+          opened++;
+
+          if (fh != nullptr) {
+            fh();
+            loaded++;
+          }
+        }
+
+        report_progress((float)done++ / extentions.size());
+      }
+
+      report_progress(1.0f);
+    });
+  }
+
+  static uint64_t HashOf(const std::string_view &bytes) {
+    return fnv1a64(bytes.data(), bytes.size());
+  }
+
+  // Warm path: a stat of the executable and of every installed file, and 
+  // one read of the manifest. The manifest describes the binary that 
+  // provisioned the home, so its installed copy (`is_installed`) is not 
+  // compared against it.
+  static bool IsHomeCurrent(const HomeManifest &manifest, const fs::path &prefix, 
+                            uintmax_t exec_size, int64_t exec_mtime, bool is_installed) {
+    if (manifest.layout != TinyWHomeLayoutVersion) return false;
+    if (!is_installed && (manifest.exec_size != exec_size || manifest.exec_mtime != exec_mtime)) return false;
+
+    for (const auto &file : built_in_files()) {
+      if (!manifest.Has(("include/tinyw" / file.name).generic_string(), HashOf(file.bytes))) return false;
+    }
+
+    std::error_code ec;
+    for (const auto &[name, hash] : manifest.files) {
+      if (!fs::exists(prefix / name, ec)) return false;
+    }
+    return true;
+  }
+
+  static fs::path ProvisionHome(const fs::path &prefix) {
+    const auto manifest_path = prefix / "settings" / "manifest";
+    const fs::path exec = ExecutionFile();
+
+    std::error_code ec;
+    auto exec_size = fs::file_size(exec, ec);
+    if (ec) {
+      std::cerr << "[e]: Unable to get execution file path --Maybe System not inited--" << std::endl;
+      return prefix;
+    }
+    auto exec_mtime = (int64_t)fs::last_write_time(exec, ec).time_since_epoch().count();
+    const auto installed = prefix / "bin" / "tinyw";
+    const bool is_installed = fs::equivalent(exec, installed, ec);
+
+    HomeManifest manifest;
+    if (HomeManifest::Load(manifest_path, manifest) && IsHomeCurrent(manifest, prefix, exec_size, exec_mtime, is_installed)) 
+      return prefix;
+
+    auto task = GenericTask("provisioning home", [&](auto report_progress) {
+      auto &created = HomeCreatedDirectories();
+      auto dirs = add_fs_prefix(prefix, GetFoldersToCreate());
+      for (const auto &dir : dirs) {
+        if (fs::create_directories(dir)) created++;
+      }
+      report_progress(0.3f);
+
+      // Only rewrite what actually changed since the last manifest.
+      std::string binary;
+      if (!read_file(exec, binary)) therr(func, "Cannot read execution file `" + exec.string() + "`");
+      const auto binary_hash = HashOf(binary);
+      if (!manifest.Has("bin/tinyw", binary_hash) || !fs::exists(installed)) {
+        if (!is_installed) copy_file_contents(exec, installed);
+        manifest.files["bin/tinyw"] = binary_hash;
+      }
+      report_progress(0.7f);
+
+      for (const auto &file : built_in_files()) {
+        const auto name = ("include/tinyw" / file.name).generic_string();
+        const auto hash = HashOf(file.bytes);
+        if (manifest.Has(name, hash) && fs::exists(prefix / name)) continue;
+        write_file_atomic(prefix / name, file.bytes.data(), file.bytes.size());
+        manifest.files[name] = hash;
+      }
+
+      manifest.layout = TinyWHomeLayoutVersion;
+      if (!is_installed) {
+        manifest.exec_size = exec_size;
+        manifest.exec_mtime = exec_mtime;
+      }
+      manifest.Save(manifest_path);
+    });
+
+    run_task_with_ui(task);
+    return prefix;
+  }
+
 public:
   static std::string ExecutionFile(const std::filesystem::path &path = "") {
     static std::filesystem::path MyPath;
@@ -191,38 +591,20 @@ public:
   }
 
   static fs::path GetHome() {
-    std::filesystem::path home = GetSystemHome();
-
-    if (!std::filesystem::exists(home / ".tinyw/")) {
-      std::filesystem::path prefix = home / ".tinyw/";
-      std::filesystem::create_directories(prefix);
-
-      std::ifstream input(ExecutionFile());
-      if (!input) {
-        std::cerr << "[e]: Unable to get execution file path --Maybe System not inited--" << std::endl;
-        return home / ".tinyw";
-      }
-      input.close();
-
-      auto copy_task = copy_file("copying execution file", ExecutionFile(), prefix / "bin" / "tinyw");
-      auto dir_task  = create_directories("creating directories", add_fs_prefix(prefix, GetFoldersToCreate()));
-      auto home_task = create_directories("creating home  ", std::vector{prefix});
-      
-      vec<GenericTask*> tasks{};
-      tasks | &home_task | &dir_task | &copy_task;
-      run_tasks(tasks);
-
-      auto cpy_built = copy_built_in_files(prefix / "include" / "tinyw/");
-      run_task_with_ui(cpy_built);
-    }
+    static const fs::path home = ProvisionHome(fs::path(GetSystemHome()) / ".tinyw");
+    return home;
+  }
 
-    return home / ".tinyw";
+  // Number of directories the provisioning of this launch had to create.
+  static size_t &HomeCreatedDirectories() {
+    static size_t created = 0;
+    return created;
   }
 
   static std::unordered_map<std::string, int> GetSubCommand(const std::vector<std::string> &cmd = {}) {
-    static std::unordered_map<std::string, int> out;
+    auto &out = SubCommands();
     if (cmd.empty()) return out;
-    auto task = has_features("checking features", cmd, out);
+    auto task = has_features("checking features", cmd, out, GetHome() / "settings" / "features.cache");
     run_task_with_ui(task);
     return out;
   }
@@ -271,93 +653,72 @@ public:
     return cores;
   }
 
-  static std::unordered_map<std::string, ExtentionObject> GetExtentions(bool reload = false) {
-    static std::unordered_map<std::string, ExtentionObject> extens;
+  static const std::unordered_map<std::string, ExtentionObject> &GetExtentions(bool reload = false) {
+    auto &extens = Extentions();
     if (!extens.empty() && !reload) return extens;
 
-    auto home = GetHome();
-    auto entries = GetEntries(home / "extentions/");
-    auto task = GenericTask("launch extentions", [&](auto report_progress){
-      for (size_t i = 0; i < entries.size(); i++) {
-        auto path = entries[i];
-
-        if (fs::exists(path)) {
-          extens[path.filename()] = ExtentionObject{
-            .path = path, 
-            .lib = DynamicLibrary(path)
-          };
-        }
-        
-        report_progress((float)(i) / entries.size());
-        std::this_thread::sleep_for(std::chrono::microseconds(10));
-      }
-
-      report_progress(1.0f);
-    });
-
+    auto task = ScanExtentionsTask(GetHome());
     run_task_with_ui(task);
 
-    std::cout << "> found " << extens.size() << " extentions" << std::endl;
+    task_out() << "> found " << extens.size() << " extentions" << std::endl;
 
     return extens;
   }
 
   static void LaunchExtentions() {
-    auto extentions = GetExtentions(true);
+    GetExtentions(true);
     auto loaded = size_t(0);
     auto opened = size_t(0);
 
-    auto task = GenericTask("loading extentions", [&](auto report_progress){
-      size_t done = 0;
-      for (auto &key:extentions) {
-        key.second.lib.Open(key.second.path);
-        if (key.second.lib.IsOpen()) {
-          ExtentionFunc fh = (ExtentionFunc)key.second.lib.GetSymbol("entry");
-          opened++;
-
-          if (fh != nullptr) {
-            fh();
-            loaded++;
-          }
-        }
+    auto task = LoadExtentionsTask(loaded, opened);
+    run_task_with_ui(task);
 
-        report_progress((float)done++ / extentions.size());
-      }
+    task_out() << "> loaded " << loaded << " extentions" << std::endl;
+    task_out() << "> opened " << opened << " extentions" << std::endl;
+  }
 
-      report_progress(1.0f);
-    });
+  // Installs a module or extention into `~/.tinyw/<subdir>/`. Existing 
+  // files are replaced atomically, so a running VM keeps its old copy.
+  static fs::path Install(const fs::path &file, const fs::path &subdir) {
+    if (!fs::is_regular_file(file)) therr(func, "No such file: " + file.string());
 
+    auto dest = GetHome() / subdir / file.filename();
+    auto task = copy_file("installing " + file.filename().string(), file, dest);
     run_task_with_ui(task);
-
-    std::cout << "> loaded " << loaded << " extentions" << std::endl;
-    std::cout << "> opened " << opened << " extentions" << std::endl;
+    return dest;
   }
 
+  // The manifest check in GetHome replaces the per-directory scan; the 
+  // layout is only re-checked when the manifest is stale.
   static void CheckAndFixHome() {
+    GetHome();
+    task_out() << "> " << HomeCreatedDirectories() << " directories created" << std::endl;
+  }
+
+  // Same work as CheckAndFixHome + GetSubCommand + LaunchExtentions, but 
+  // laid out as a graph: feature probing overlaps with extention loading.
+  static void Startup(const std::vector<std::string> &cmd) {
     auto home = GetHome();
-    std::vector<fs::path> expected_dirs = add_fs_prefix(home, GetFoldersToCreate());
-    auto created = size_t(0);
+    auto loaded = size_t(0);
+    auto opened = size_t(0);
 
-    auto task = GenericTask("checking home", [&](auto report_progress) {
-      size_t total = expected_dirs.size();
-      size_t done = 0;
-      for (const auto& dir : expected_dirs) {
-        if (!fs::exists(dir)) {
-          std::error_code ec;
-          fs::create_directories(dir, ec);
-          created++;
-        }
+    auto features_task = has_features("checking features", cmd, SubCommands(), home / "settings" / "features.cache");
+    auto scan_task     = ScanExtentionsTask(home);
+    auto load_task     = LoadExtentionsTask(loaded, opened);
 
-        ++done;
-        report_progress(static_cast<float>(done) / total);
-      }
-    });
+    TaskGraph graph;
+    graph.add(features_task);
+    auto scanned = graph.add(scan_task);
+    graph.add(load_task, {scanned});
+    graph.run();
 
-    run_task_with_ui(task);
-    std::cout << "> " << created << " directories created" << std::endl;
+    task_out() << "> " << HomeCreatedDirectories() << " directories created" << std::endl;
+    task_out() << "> found " << Extentions().size() << " extentions" << std::endl;
+    task_out() << "> loaded " << loaded << " extentions" << std::endl;
+    task_out() << "> opened " << opened << " extentions" << std::endl;
   }
 };
 
 
 
-TinyWDeclEnd
\ No newline at end of file
+TinyWDeclEnd
@@ -2,25 +2,135 @@
 
 #include <mutex>
 #include <stack>
+#include <deque>
 #include <thread>
 #include <chrono>
 #include <atomic>
 #include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <vector>
 #include <cstdint>
+#include <sstream>
 #include <iomanip>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include <functional>
 #include <filesystem>
+#include <unordered_map>
+#include <condition_variable>
+
+#if defined(_WIN32)
+  #include <io.h>
+  #include <process.h>
+  #define TINYW_ISATTY(fd) _isatty(fd)
+  #define TINYW_FILENO(f) _fileno(f)
+#else
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <sys/stat.h>
+  #define TINYW_ISATTY(fd) isatty(fd)
+  #define TINYW_FILENO(f) fileno(f)
+#endif
+
+#if defined(__linux__)
+  #include <sys/ioctl.h>
+  #include <sys/sendfile.h>
+  #include <linux/fs.h>
+#endif
 
 #include "glob.hpp"
+#include "trace.hpp"
 
 TinyWDeclStart
 
+enum class TaskUIMode { Auto, Interactive, Quiet };
+
+TaskUIMode &task_ui_mode() {
+  static TaskUIMode mode = TaskUIMode::Auto;
+  return mode;
+}
+
+// Auto mode only renders progress bars when stdout is a terminal.
+bool task_ui_enabled() {
+  switch (task_ui_mode()) {
+    case TaskUIMode::Interactive: return true;
+    case TaskUIMode::Quiet: return false;
+    default: {
+      static const bool tty = TINYW_ISATTY(TINYW_FILENO(stdout));
+      return tty;
+    }
+  }
+}
+
+// Status stream for startup chatter; swallows everything when the UI is off.
+std::ostream &task_out() {
+  static std::ostream null_stream(nullptr);
+  return task_ui_enabled() ? std::cout : null_stream;
+}
+
+struct TaskTiming {
+  std::string title;
+  std::chrono::steady_clock::duration elapsed;
+};
+
+std::mutex &task_timings_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+std::vector<TaskTiming> &task_timings() {
+  static std::vector<TaskTiming> timings;
+  return timings;
+}
+
+bool &task_timings_report() {
+  static bool report = false;
+  return report;
+}
+
+void record_task_timing(const std::string &title, std::chrono::steady_clock::duration elapsed) {
+  std::lock_guard<std::mutex> lock(task_timings_mutex());
+  task_timings().push_back({title, elapsed});
+}
+
+std::string format_elapsed(std::chrono::steady_clock::duration elapsed) {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(3) 
+     << std::chrono::duration<double, std::milli>(elapsed).count() << " ms";
+  return ss.str();
+}
+
+// Prints and forgets the timings recorded since the last call.
+void print_task_timings(std::ostream &out) {
+  std::lock_guard<std::mutex> lock(task_timings_mutex());
+  if (task_timings().empty()) return;
+  std::chrono::steady_clock::duration total{};
+
+  out << "> startup timings:\n";
+  for (const auto &timing : task_timings()) {
+    out << ">   " << std::left << std::setw(28) << timing.title << std::right 
+        << std::setw(14) << format_elapsed(timing.elapsed) << "\n";
+    total += timing.elapsed;
+  }
+  out << ">   " << std::left << std::setw(28) << "sum" << std::right 
+      << std::setw(14) << format_elapsed(total) << std::endl;
+  task_timings().clear();
+}
+
 class GenericTask {
 	std::string _title;
 	std::function<void(std::function<void(float)>)> _work;
 	std::atomic<float> _progress = 0.0f;
+	std::chrono::steady_clock::duration _elapsed{};
+
+	void finish(std::chrono::steady_clock::time_point started) {
+		_elapsed = std::chrono::steady_clock::now() - started;
+	}
 
 public:
 	GenericTask(const std::string& title,
@@ -29,113 +139,469 @@ public:
 
 	const std::string& get_title() const { return _title; }
 	float get_progress() const { return _progress.load(); }
+	std::chrono::steady_clock::duration get_elapsed() const { return _elapsed; }
 
 	void run() {
-		_work([this](float p) {
-			_progress.store(std::clamp(p, 0.0f, 1.0f));
-		});
+		TraceSpan span(Tracer::Enabled() ? tracer().Intern(_title) : nullptr);
+		auto started = std::chrono::steady_clock::now();
+		try {
+			_work([this](float p) {
+				_progress.store(std::clamp(p, 0.0f, 1.0f));
+			});
+		} catch (...) {
+			finish(started);
+			throw;
+		}
 		_progress.store(1.0f);
+		finish(started);
 	}
 };
 
+// Fixed set of long-lived threads shared by every task runner, so a task 
+// costs a queue push instead of a thread spawn.
+class WorkerPool {
+  std::vector<std::thread> _workers;
+  std::deque<std::function<void()>> _jobs;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _stopping = false;
+
+  static bool &in_worker_flag() {
+    thread_local bool in_worker = false;
+    return in_worker;
+  }
+
+  void worker_loop() {
+    in_worker_flag() = true;
+    for (;;) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+        if (_jobs.empty()) return;
+        job = std::move(_jobs.front());
+        _jobs.pop_front();
+      }
+      job();
+    }
+  }
+
+public:
+  explicit WorkerPool(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      _workers.emplace_back([this] { worker_loop(); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _cv.notify_all();
+    for (auto &worker : _workers) worker.join();
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool &operator=(const WorkerPool&) = delete;
+
+  void submit(std::function<void()> job) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _jobs.push_back(std::move(job));
+    }
+    _cv.notify_one();
+  }
+
+  size_t size() const { return _workers.size(); }
+
+  // Jobs must not block on other jobs of the same pool; callers use this to 
+  // run nested work inline instead.
+  static bool in_worker() { return in_worker_flag(); }
+
+  static WorkerPool &shared() {
+    static WorkerPool pool(std::max<size_t>(2, std::thread::hardware_concurrency()));
+    return pool;
+  }
+};
+
+std::string describe_task_exception(std::exception_ptr exc) {
+  std::stringstream ss;
+  ss << "\n> C++ Exception caught from thread " << std::this_thread::get_id();
+  try {
+    std::rethrow_exception(exc);
+  } catch (const std::exception &e) {
+    ss << "\n> what():" << e.what() << std::endl;
+  } catch (...) {
+    ss << "\n> <unknown exception>" << std::endl;
+  }
+  return ss.str();
+}
+
+void draw_task_bar(float progress, const std::string &title) {
+  const int bar_width = 24;
+  int pos = static_cast<int>(progress * bar_width);
+
+  std::cout << "\r" << "> [";
+  for (int i = 0; i < bar_width; ++i) {
+    if (i < pos) std::cout << "#";
+    else std::cout << ".";
+  }
+  
+  std::cout << "] " << std::setw(5) << std::setfill(' ') << std::fixed << std::setprecision(1) << (progress * 100.0f) << "%" 
+      " | " << title
+      << std::flush;
+}
+
+// Headless path: no thread, no rendering, just the work and its timing. 
+// On a pool worker, errors go back to the job running this task, which 
+// reports them to the main thread: `exit` there would run ~WorkerPool on 
+// one of its own workers.
+void run_task_quiet(GenericTask& task) {
+  try {
+    task.run();
+  } catch (...) {
+    if (WorkerPool::in_worker()) throw;
+    std::cerr << describe_task_exception(std::current_exception()) << std::flush;
+    exit(-1);
+  }
+
+  record_task_timing(task.get_title(), task.get_elapsed());
+}
+
 void run_task_with_ui(GenericTask& task) {
+  if (!task_ui_enabled() || WorkerPool::in_worker()) return run_task_quiet(task);
+
   std::string what;
-  std::mutex what_mutex;
   std::atomic<bool> throw_requested{false};
-  std::thread runner([&]() { 
+  std::mutex done_mutex;
+  std::condition_variable done_cv;
+  bool done = false;
+
+  WorkerPool::shared().submit([&]() { 
     try {
       task.run();
-      return;
-    } catch (const std::runtime_error &e) {
-      std::stringstream ss;
-      ss << "\n> C++ Exception caught from thread " << std::this_thread::get_id() <<
-                   "\n> what():"
-                   << e.what() << std::endl;
-      {
-        std::lock_guard<std::mutex> lock(what_mutex);
-        what = ss.str();
-      }
-    } catch (const std::exception &e) {
-      std::stringstream ss;
-      ss << "\n> C++ Exception caught from thread " << std::this_thread::get_id() <<
-      "\n> what():"
-      << e.what() << std::endl;
-      {
-        std::lock_guard<std::mutex> lock(what_mutex);
-        what = ss.str();
-      }
     } catch (...) {
-      std::stringstream ss;
-      ss << "\n> C++ Exception caught from thread " << std::this_thread::get_id() <<
-      "\n> <unknown exception>" << std::endl;
-      {
-        std::lock_guard<std::mutex> lock(what_mutex);
-        what = ss.str();
-      }
+      what = describe_task_exception(std::current_exception());
+      throw_requested.store(true);
     }
 
-    throw_requested.store(true);
+    // Notified under the lock: the waiter owns these locals and may return 
+    // as soon as it can observe `done`.
+    std::lock_guard<std::mutex> lock(done_mutex);
+    done = true;
+    done_cv.notify_all();
   });
 
-  const int bar_width = 24;
+  // Redraws while the task is running, but wakes up the moment it finishes.
+  {
+    std::unique_lock<std::mutex> lock(done_mutex);
+    while (!done_cv.wait_for(lock, std::chrono::milliseconds(100), [&] { return done; })) {
+      draw_task_bar(task.get_progress(), task.get_title());
+    }
+  }
+
+  if (throw_requested.load()) {
+    draw_task_bar(task.get_progress(), task.get_title());
+    std::cout << what << std::endl;
+    exit(-1);
+  }
+
+  record_task_timing(task.get_title(), task.get_elapsed());
+  std::cout  << "\r" << "> [########################] 100.0% | " << task.get_title() 
+             << " (" << format_elapsed(task.get_elapsed()) << ")\n";
+}
+
+void run_tasks(const std::vector<GenericTask*> &tasks) {
+  for (auto task:tasks) {
+    run_task_with_ui(*task);
+  }
+}
+
+// Runs tasks on the shared pool as soon as all of their dependencies are 
+// done. Independent tasks overlap; the UI line lists whatever is running.
+class TaskGraph {
+public:
+  typedef size_t NodeId;
+
+private:
+  struct Node {
+    GenericTask *task;
+    std::vector<NodeId> dependents;
+    size_t pending = 0;
+    bool running = false;
+    bool done = false;
+  };
+
+  std::vector<Node> _nodes;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::vector<NodeId> _finished;
+  std::string _what;
+  size_t _running = 0;
+  bool _failed = false;
+
+  void launch(NodeId id) {
+    _nodes[id].running = true;
+    _running++;
+    WorkerPool::shared().submit([this, id] {
+      std::string what;
+      try {
+        _nodes[id].task->run();
+      } catch (...) {
+        what = describe_task_exception(std::current_exception());
+      }
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!what.empty() && !_failed) {
+        _failed = true;
+        _what = what;
+      }
+      _finished.push_back(id);
+      _cv.notify_all();
+    });
+  }
 
-  while (task.get_progress() < 1.0f) {
-    float progress = task.get_progress();
-    int pos = static_cast<int>(progress * bar_width);
+  // Called with `_mutex` held.
+  void complete(NodeId id) {
+    auto &node = _nodes[id];
+    node.running = false;
+    node.done = true;
+    _running--;
+    if (_failed) return;
 
-    std::cout << "\r" << "> [";
-    for (int i = 0; i < bar_width; ++i) {
-      if (i < pos) std::cout << "#";
-      else std::cout << ".";
+    for (auto dependent : node.dependents) {
+      if (--_nodes[dependent].pending == 0) launch(dependent);
     }
-    
-    std::cout << "] " << std::setw(5) << std::setfill(' ') << std::fixed << std::setprecision(1) << (progress * 100.0f) << "%" 
-        " | " << task.get_title()
-        << std::flush;
+  }
+
+  std::string running_titles() const {
+    std::string titles;
+    for (const auto &node : _nodes) {
+      if (!node.running) continue;
+      if (!titles.empty()) titles += ", ";
+      titles += node.task->get_title();
+    }
+    return titles;
+  }
+
+  float overall_progress() const {
+    if (_nodes.empty()) return 1.0f;
+    float sum = 0.0f;
+    for (const auto &node : _nodes) sum += node.done ? 1.0f : node.task->get_progress();
+    return sum / _nodes.size();
+  }
+
+public:
+  NodeId add(GenericTask &task, const std::vector<NodeId> &depends_on = {}) {
+    NodeId id = _nodes.size();
+    _nodes.push_back(Node{&task, {}, depends_on.size()});
+    for (auto dep : depends_on) {
+      if (dep >= id) therr(func, AnyString("Task `") | task.get_title() | "` depends on unknown node " | dep);
+      _nodes[dep].dependents.push_back(id);
+    }
+    return id;
+  }
+
+  void run() {
+    const bool ui = task_ui_enabled();
+    size_t remaining = _nodes.size();
+    size_t last_width = 0;
 
-    if (throw_requested.load()) {
-      std::lock_guard<std::mutex> lock(what_mutex);
-      std::cout << what << std::endl;
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (NodeId id = 0; id < _nodes.size(); id++) {
+      if (_nodes[id].pending == 0) launch(id);
+    }
+
+    while (remaining > 0 && _running > 0) {
+      _cv.wait_for(lock, std::chrono::milliseconds(100), [this] { return !_finished.empty(); });
+
+      auto finished = std::move(_finished);
+      _finished.clear();
+
+      for (auto id : finished) {
+        complete(id);
+        remaining--;
+
+        auto task = _nodes[id].task;
+        if (_failed) continue;
+        record_task_timing(task->get_title(), task->get_elapsed());
+        if (ui) {
+          std::string line = "> [########################] 100.0% | " + task->get_title() + 
+                             " (" + format_elapsed(task->get_elapsed()) + ")";
+          std::cout << "\r" << line << std::string(last_width > line.size() ? last_width - line.size() : 0, ' ') << "\n";
+          last_width = 0;
+        }
+      }
+
+      if (ui && _running > 0) {
+        std::string titles = running_titles();
+        draw_task_bar(overall_progress(), titles);
+        size_t width = titles.size() + 40;
+        if (width < last_width) std::cout << std::string(last_width - width, ' ') << std::flush;
+        last_width = width;
+      }
+    }
+
+    if (_failed) {
+      (ui ? std::cout : std::cerr) << _what << std::endl;
       exit(-1);
     }
-      
-      
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
   }
+};
 
-  runner.join();
 
-  std::cout  << "\r" << "> [########################] 100.0% | " << task.get_title() << "\n";
+// A sibling of `dst` that no other writer uses, be it another thread or 
+// another process provisioning the same home.
+fs::path unique_temp_path(const fs::path &dst) {
+  static std::atomic<uint64_t> counter{0};
+#if defined(_WIN32)
+  const auto pid = _getpid();
+#else
+  const auto pid = getpid();
+#endif
+  auto tmp = dst;
+  tmp += ".tmp." + std::to_string(pid) + "." + std::to_string(counter.fetch_add(1));
+  return tmp;
 }
 
-void run_tasks(const std::vector<GenericTask*> &tasks) {
-  for (auto task:tasks) {
-    run_task_with_ui(*task);
+// Writes to a sibling temporary file and renames it over `dst`, so readers 
+// never observe a half-written file. The temporary is removed on failure.
+void write_file_atomic(const fs::path &dst, const void *data, size_t len, 
+                       fs::perms perms = fs::perms::unknown) {
+  const auto tmp = unique_temp_path(dst);
+  try {
+    {
+      std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+      if (!out) therr(func, "Cannot open `" + tmp.string() + "` for writing");
+      out.write(static_cast<const char*>(data), len);
+      if (!out.flush()) therr(func, "Failed to write `" + tmp.string() + "`");
+    }
+    if (perms != fs::perms::unknown) fs::permissions(tmp, perms);
+    fs::rename(tmp, dst);
+  } catch (...) {
+    std::error_code ec;
+    fs::remove(tmp, ec);
+    throw;
   }
 }
 
+bool read_file(const fs::path &file, std::string &out) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in) return false;
+  out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  return !in.bad();
+}
+
+#define TinyWCopyChunk (size_t(8) << 20)
+
+#if !defined(_WIN32)
+// Last resort: plain read/write through a page-aligned buffer.
+void copy_fd_buffered(int in, int out, uintmax_t total, size_t buffer_size, 
+                      const std::function<void(float)> &report_progress) {
+  void *buffer = nullptr;
+  buffer_size = std::max<size_t>(buffer_size, 4096);
+  if (posix_memalign(&buffer, 4096, buffer_size) != 0) therr(func, "Cannot allocate copy buffer");
+  std::unique_ptr<void, decltype(&free)> guard(buffer, &free);
+
+  uintmax_t copied = 0, reported = 0;
+  for (;;) {
+    auto got = read(in, buffer, buffer_size);
+    if (got < 0 && errno == EINTR) continue;
+    if (got < 0) therr(func, std::string("read(): ") + strerror(errno));
+    if (got == 0) break;
+
+    for (ssize_t done = 0; done < got;) {
+      auto put = write(out, static_cast<char*>(buffer) + done, got - done);
+      if (put < 0 && errno == EINTR) continue;
+      if (put < 0) therr(func, std::string("write(): ") + strerror(errno));
+      done += put;
+    }
 
-GenericTask copy_file(const std::string &title, const std::string &file1, const std::string &file2, const size_t buffer_size = 1) {
-  return GenericTask(title, [&](auto report_progress) {
-    std::ifstream input(file1);
-    std::ofstream out(file2);
-      
-    input.seekg(0, std::ios::end);
-    auto total = input.tellg();
-    input.seekg(0);
-    
-    char *buffer = new char[buffer_size];
-    size_t copied = 0;
-    
-    while (input && out) {
-      input.read(buffer, buffer_size);
-      auto bytes = input.gcount();
-      out.write(buffer, bytes);
-      copied += bytes;
+    copied += got;
+    if (copied - reported >= TinyWCopyChunk && total) {
+      reported = copied;
       report_progress(float(copied) / total);
     }
+  }
+}
+
+// Kernel-side copies, cheapest first. Returns false when none of them 
+// applies and nothing was written yet.
+bool copy_fd_in_kernel(int in, int out, uintmax_t total, 
+                       const std::function<void(float)> &report_progress) {
+#if defined(__linux__)
+  if (total == 0) return false;  // procfs & co. report a size of 0
+  if (ioctl(out, FICLONE, in) == 0) return true;
+
+  uintmax_t copied = 0;
+  bool use_sendfile = false;
+  while (copied < total) {
+    size_t chunk = std::min<uintmax_t>(TinyWCopyChunk, total - copied);
+    ssize_t n = use_sendfile ? sendfile(out, in, nullptr, chunk) 
+                             : copy_file_range(in, nullptr, out, nullptr, chunk, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && copied == 0 && !use_sendfile && 
+        (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+      use_sendfile = true;
+      continue;
+    }
+    if (n < 0 && copied == 0) return false;
+    if (n < 0) therr(func, std::string("in-kernel copy: ") + strerror(errno));
+    if (n == 0) break;
+
+    copied += n;
+    report_progress(float(copied) / total);
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+#endif
 
-    delete[] buffer;
+// Copies `src` over `dst` through a temporary file and a rename, keeping 
+// the permission bits of `src`. Tries a reflink, then copy_file_range and 
+// sendfile, and only then falls back to a buffered loop.
+void copy_file_contents(const fs::path &src, const fs::path &dst, 
+                        const std::function<void(float)> &report_progress = [](float){}, 
+                        size_t buffer_size = size_t(1) << 20) {
+  const auto tmp = unique_temp_path(dst);
+  try {
+#if defined(_WIN32)
+    (void)buffer_size;
+    fs::copy_file(src, tmp, fs::copy_options::overwrite_existing);
+#else
+    int in = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) therr(func, "Cannot open `" + src.string() + "`: " + strerror(errno));
+    std::unique_ptr<int, void(*)(int*)> in_guard(&in, [](int *fd) { close(*fd); });
+
+    struct stat st;
+    if (fstat(in, &st) != 0) therr(func, "Cannot stat `" + src.string() + "`: " + strerror(errno));
+
+    int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+    if (out < 0) therr(func, "Cannot open `" + tmp.string() + "`: " + strerror(errno));
+    std::unique_ptr<int, void(*)(int*)> out_guard(&out, [](int *fd) { close(*fd); });
+
+    if (!copy_fd_in_kernel(in, out, st.st_size, report_progress)) {
+      copy_fd_buffered(in, out, st.st_size, buffer_size, report_progress);
+    }
+    if (fchmod(out, st.st_mode & 07777) != 0) therr(func, "Cannot chmod `" + tmp.string() + "`: " + strerror(errno));
+#endif
+
+    fs::rename(tmp, dst);
+  } catch (...) {
+    std::error_code ec;
+    fs::remove(tmp, ec);
+    throw;
+  }
+  report_progress(1.0f);
+}
+
+GenericTask copy_file(const std::string &title, const fs::path &file1, const fs::path &file2, 
+                      const size_t buffer_size = size_t(1) << 20) {
+  return GenericTask(title, [=](auto report_progress) {
+    copy_file_contents(file1, file2, report_progress, buffer_size);
   });
 }
 
@@ -155,21 +621,124 @@ GenericTask create_directories(const std::string &title, const std::vector<strin
   });
 }
 
+std::vector<fs::path> search_path_dirs() {
+#if defined(_WIN32)
+  const char separator = ';';
+#else
+  const char separator = ':';
+#endif
+  std::vector<fs::path> dirs;
+  const char *env = std::getenv("PATH");
+  if (!env) return dirs;
+
+  std::stringstream ss(env);
+  std::string dir;
+  while (std::getline(ss, dir, separator)) {
+    dirs.push_back(dir.empty() ? fs::path(".") : fs::path(dir));
+  }
+  return dirs;
+}
+
+bool is_executable_file(const fs::path &file) {
+  std::error_code ec;
+  if (!fs::is_regular_file(file, ec)) return false;
+#if defined(_WIN32)
+  return true;
+#else
+  return access(file.c_str(), X_OK) == 0;
+#endif
+}
+
+// In-process `command -v`: stats the PATH candidates instead of forking a shell.
+bool resolve_command(const std::string &cmd, const std::vector<fs::path> &dirs) {
+  if (cmd.find('/') != std::string::npos) return is_executable_file(cmd);
+
+#if defined(_WIN32)
+  std::vector<std::string> exts{""};
+  const char *pathext = std::getenv("PATHEXT");
+  std::stringstream ss(pathext ? pathext : ".COM;.EXE;.BAT;.CMD");
+  std::string ext;
+  while (std::getline(ss, ext, ';')) exts.push_back(to_lowercase(ext));
+#else
+  const std::vector<std::string> exts{""};
+#endif
+
+  for (const auto &dir : dirs) {
+    for (const auto &ext : exts) {
+      if (is_executable_file(dir / (cmd + ext))) return true;
+    }
+  }
+  return false;
+}
+
+// Changes whenever PATH, one of its directories or the probed list changes.
+uint64_t features_fingerprint(const std::vector<fs::path> &dirs, const std::vector<std::string> &CMDs) {
+  uint64_t hash = fnv1a64("", 0);
+  for (const auto &dir : dirs) {
+    auto str = dir.string();
+    hash = fnv1a64(str.data(), str.size() + 1, hash);
+
+    std::error_code ec;
+    auto mtime = fs::last_write_time(dir, ec).time_since_epoch().count();
+    if (ec) mtime = 0;
+    hash = fnv1a64(&mtime, sizeof(mtime), hash);
+  }
+  for (const auto &cmd : CMDs) hash = fnv1a64(cmd.data(), cmd.size() + 1, hash);
+  return hash;
+}
+
+bool load_features_cache(const fs::path &cache_file, uint64_t fingerprint, 
+                         std::unordered_map<std::string, int> &out) {
+  std::ifstream in(cache_file);
+  std::string magic;
+  uint64_t key = 0;
+  if (!(in >> magic >> std::hex >> key >> std::dec) || magic != "tinyw-features-v1" || key != fingerprint) 
+    return false;
+
+  std::unordered_map<std::string, int> cached;
+  std::string cmd;
+  int status;
+  while (in >> cmd >> status) cached[cmd] = status;
+
+  for (const auto &[name, value] : cached) out[name] = value;
+  return true;
+}
+
+void save_features_cache(const fs::path &cache_file, uint64_t fingerprint, 
+                         const std::vector<std::string> &CMDs, 
+                         const std::unordered_map<std::string, int> &out) {
+  std::error_code ec;
+  const auto tmp = unique_temp_path(cache_file);
+  bool written;
+  {
+    std::ofstream file(tmp, std::ios::trunc);
+    if (!file) return;
+    file << "tinyw-features-v1 " << std::hex << fingerprint << std::dec << "\n";
+    for (const auto &cmd : CMDs) file << cmd << " " << out.at(cmd) << "\n";
+    written = static_cast<bool>(file.flush());
+  }
+  if (written) fs::rename(tmp, cache_file, ec);
+  if (!written || ec) fs::remove(tmp, ec);
+}
+
+// Fills `out` with 0 for every available command and 1 otherwise. When 
+// `cache_file` is set, a matching fingerprint skips probing altogether.
 GenericTask has_features(const std::string& title,
                          const std::vector<std::string>& CMDs,
-                         std::unordered_map<std::string, int>& out) {
-  return GenericTask(title, [&](auto report_progress) {
+                         std::unordered_map<std::string, int>& out,
+                         const fs::path &cache_file = "") {
+  return GenericTask(title, [&CMDs, &out, cache_file](auto report_progress) {
+    auto dirs = search_path_dirs();
+    auto fingerprint = features_fingerprint(dirs, CMDs);
+    if (!cache_file.empty() && load_features_cache(cache_file, fingerprint, out)) return;
+
     for (size_t i = 0; i < CMDs.size(); i++) {
       const auto& cmd = CMDs[i];
-#if defined(_WIN32)
-      std::string test_cmd = "where " + cmd + " >nul 2>&1";
-#else
-      std::string test_cmd = "command -v " + cmd + " >/dev/null 2>&1";
-#endif
-      out[cmd] = std::system(test_cmd.c_str());
+      out[cmd] = resolve_command(cmd, dirs) ? 0 : 1;
       report_progress(static_cast<float>(i + 1) / CMDs.size());
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
+
+    if (!cache_file.empty()) save_features_cache(cache_file, fingerprint, CMDs, out);
   });
 }
 
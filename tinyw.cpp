@@ -1,15 +1,75 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <sstream>
+#include <fstream>
 
 #include "glob.hpp"
 #include "sys.hpp"
 #include "tasks.hpp"
 #include "vec.hpp"
 #include "core.hpp"
+#include "sched.hpp"
+#include "builtin.hpp"
+#include "bench.hpp"
 
 TinyWDeclStart
 
+  // tinyw batch [-workers <N>] [-quantum <cycles>] <file>
+  // Each non-empty line of <file> not starting with '#' holds the `run` 
+  // arguments of one VM; all of them are then scheduled over N workers.
+  void batch(const std::vector<std::string> &args) {
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t quantum = 10000;
+    fs::path list;
+
+    for (size_t i = 0; i < args.size(); i++) {
+      auto arg = to_lowercase(args[i]);
+      if (arg == "-workers" && i + 1 < args.size()) workers = std::stoul(args[++i]);
+      else if (arg == "-quantum" && i + 1 < args.size()) quantum = std::stoull(args[++i]);
+      else if (arg == "-core" && i + 2 < args.size()) i += 2;
+      else list = args[i];
+    }
+    if (list.empty()) therr(func, "Usage: tinyw batch [-workers <N>] [-quantum <cycles>] <file>");
+
+    std::ifstream in(list);
+    if (!in) therr(func, "Cannot open batch file: " + list.string());
+
+    std::vector<std::unique_ptr<Core>> cores;
+    std::map<fs::path, size_t> owners;
+    VMScheduler scheduler(workers, quantum);
+
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); number++) {
+      std::istringstream words(line);
+      std::vector<std::string> vm_args{"run"};
+      for (std::string word; words >> word;) vm_args.push_back(word);
+      if (vm_args.size() == 1 || vm_args[1][0] == '#') continue;
+
+      // Plain modules keep their state in globals: one library per VM. 
+      // Checked before loading, as a second `init` would already clobber 
+      // the VM that owns the library.
+      for (const auto &file : Core::GetExclusiveModuleFiles(vm_args)) {
+        auto canonical = is_builtin_module(file) ? file : fs::weakly_canonical(file);
+        auto owner = owners.emplace(canonical, number);
+        if (!owner.second) 
+          therr(func, AnyString("Line ") | number | " shares " | canonical.string() | " with line " | owner.first->second | 
+                      "; plain modules need one file per VM (or use the instance ABI)");
+      }
+
+      auto core = std::make_unique<Core>();
+      core->Load(vm_args);
+      scheduler.Add(list.filename().string() + ":" + std::to_string(number), core.get());
+      cores.push_back(std::move(core));
+    }
+
+    scheduler.Run();
+    scheduler.Report(std::cout);
+  }
+
   void exec(const std::vector<std::string> &argv) {
     if (argv.size() < 1) therr(func, AnyString("Null argument vector (argv) -- No such task") | argv);
     
@@ -24,41 +84,104 @@ TinyWDeclStart
       } catch (...) {
         therr(func, "Unknown exception caught from main thread");
       }
+    } else if (argv[0] == "batch") {
+      batch(args);
+    } else if (argv[0] == "bench") {
+      Benchmark bench;
+      bench.ParseArguments(args);
+      bench.Run();
+    } else if (argv[0] == "install") {
+      if (args.size() < 2 || (args[0] != "-module" && args[0] != "-extention"))
+        therr(func, AnyString("Usage: tinyw install <-module|-extention> <file>...") | " argv[] (internal): " | argv);
+
+      fs::path subdir = args[0] == "-module" ? "bin" : "extentions";
+      for (size_t i = 1; i < args.size(); i++) {
+        if (to_lowercase(args[i]) == "-core") { i += 2; continue; }
+        auto dest = System::Install(args[i], subdir);
+        task_out() << "> installed " << dest.string() << std::endl;
+      }
     } else {
       AnyString anyString("Unknown argument: '" + argv[0] + "'");
       therr(func, anyString | argv[0] | " argv[] (internal): " | argv);
     }
   }
 
+  // Startup tasks run before `Core::Run` parses its arguments, so the 
+  // UI-related `-core` pairs are picked up here, as is `-core trace` so 
+  // that the startup tasks show up in the trace.
+  void ApplyStartupOptions(const std::vector<std::string> &args) {
+    std::string trace, trace_buffer = "64K";
+    for (size_t i = 0; i + 2 < args.size(); i++) {
+      if (to_lowercase(args[i]) != "-core") continue;
+
+      if (args[i + 1] == "quiet") {
+        task_ui_mode() = parse_bool(args[i + 2]) ? TaskUIMode::Quiet : TaskUIMode::Interactive;
+      } else if (args[i + 1] == "timings") {
+        task_timings_report() = parse_bool(args[i + 2]);
+      } else if (args[i + 1] == "trace") {
+        trace = args[i + 2];
+      } else if (args[i + 1] == "trace-buffer") {
+        trace_buffer = args[i + 2];
+      }
+
+      i += 2;
+    }
+
+    if (!trace.empty()) tracer().Start(trace, parse_size(trace_buffer));
+  }
+
   int TinyWylandMain(int argc, char *const argv[]) {
     if (argc < 2) return -1;
     
-    System::ExecutionFile(argv[0]);
-    System::CheckAndFixHome();
-    System::GetSubCommand({PYTHON, "curl", CLEAR, "git", "g++", "gcc"});
-    System::LaunchExtentions();
-    
     std::vector<std::string> args;
     for (int i = 1; i < argc; i++) args.push_back(argv[i]);
 
+    ApplyStartupOptions(args);
+
+    System::ExecutionFile(argv[0]);
+    System::Startup({PYTHON, "curl", CLEAR, "git", "g++", "gcc"});
+
+    if (task_timings_report()) print_task_timings(std::cerr);
+
+    int status = 0;
     try {
       exec(args);
     } catch (const std::runtime_error &e) {
       std::cerr << "> [i:err]: C++ Exception:\t" << e.what();
-      return -1;
+      status = -1;
     } catch (const std::exception &e) {
       std::cerr << "> [i:err]: C++ Exception\t" << e.what();
-      return -1;
+      status = -1;
     } catch (...) {
       std::cerr << "> [i:err]: Unknown Exception" << std::endl;
-      return -1;
+      status = -1;
     }
     
-    return 0;
+    tracer().Finish();
+    return status;
   }
 
 TinyWDeclEnd
 
+// Called by the TINYW_ENTRY registrations of static modules (see 
+// base/tinyc.h) during static initialization. The module's kind follows 
+// from the entry points it registers. Defined here, in the one translation
+// unit that has `main`, as module objects linked with it only declare it.
+extern "C" int tinyw_static_symbol(const char *module, const char *symbol, void *address) {
+  using namespace wylma::wyland;
+  auto &entry = builtin_modules()[module];
+  const std::string name = symbol;
+  if (!entry.linked) {
+    entry.linked = true;
+    entry.kind = "cpu";
+    entry.description = "statically linked";
+  }
+  if (name.starts_with("send_bytes")) entry.kind = "gpu";
+  else if (name.starts_with("clear") || name.starts_with("get_memory_map")) entry.kind = "memory";
+  entry.symbols[name] = address;
+  return 1;
+}
+
 int main(int argc, char *const argv[]) {
   return wylma::wyland::TinyWylandMain(argc, argv);
 }
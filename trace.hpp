@@ -0,0 +1,369 @@
+#pragma once
+
+#include <bit>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <unordered_set>
+#include <unordered_map>
+
+#if !defined(_WIN32)
+  #include <signal.h>
+  #include <unistd.h>
+  #include <semaphore.h>
+#endif
+
+#include "glob.hpp"
+
+TinyWDeclStart
+
+// tasks.hpp includes this header for GenericTask's spans.
+void write_file_atomic(const fs::path &dst, const void *data, size_t len, fs::perms perms);
+
+// Host side of `tinyw_tracer` (`-core trace <file>`). Each thread records
+// into its own ring of the last `-core trace-buffer` events, with no lock
+// and no allocation once its ring exists; the ring of an exited thread is
+// handed to the next new one. The rings are written out as Chrome 
+// trace-event JSON when the process ends, and whenever it receives SIGUSR1.
+// While tracing is off, recording is one load and one branch.
+class Tracer {
+private:
+  struct Event {
+    int64_t time;       // nanoseconds since the tracer was created
+    const char *name;
+    int64_t value;
+    uint32_t type;      // TINYW_TRACE_*
+  };
+
+  // A ring slot. The dump reads slots their thread may be rewriting, so 
+  // the fields are (relaxed) atomics; see `Record` and `ToJSON`.
+  struct Slot {
+    std::atomic<int64_t> time;
+    std::atomic<const char*> name;
+    std::atomic<int64_t> value;
+    std::atomic<uint32_t> type;
+
+    void Store(const Event &event) {
+      time.store(event.time, std::memory_order_relaxed);
+      name.store(event.name, std::memory_order_relaxed);
+      value.store(event.value, std::memory_order_relaxed);
+      type.store(event.type, std::memory_order_relaxed);
+    }
+
+    Event Load() const {
+      return Event{ time.load(std::memory_order_relaxed), name.load(std::memory_order_relaxed), 
+                    value.load(std::memory_order_relaxed), type.load(std::memory_order_relaxed) };
+    }
+  };
+
+  // A thread that recorded into a ring, from event `first` on (up to the
+  // next owner's `first`).
+  struct Owner {
+    uint64_t first = 0;
+    uint64_t tid = 0;
+    std::string name;
+  };
+
+  struct ThreadRing {
+    std::unique_ptr<Slot[]> events;
+    uint64_t mask = 0;
+    std::atomic<uint64_t> head{0};   // events ever recorded
+    std::vector<Owner> owners;       // oldest first, guarded by the tracer lock
+  };
+
+  // Gives the ring back when its thread exits.
+  struct LocalHolder {
+    ThreadRing *ring = nullptr;
+    ~LocalHolder() { if (ring) Instance().Release(*ring); }
+  };
+
+  alignas(std::atomic_ref<uint32_t>::required_alignment) static inline uint32_t enabled_ = 0;
+
+  std::mutex lock_;
+  std::vector<std::shared_ptr<ThreadRing>> rings_;   // in use or free, never freed
+  std::vector<ThreadRing*> free_;                     // rings whose thread exited
+  uint64_t threads_ = 0;
+  std::unordered_set<std::string> names_;
+  const std::chrono::steady_clock::time_point origin_ = std::chrono::steady_clock::now();
+  uint64_t capacity_ = 65536;
+  fs::path path_;
+  tinyw_tracer abi_{};
+
+#if !defined(_WIN32)
+  static inline sem_t *dump_request_ = nullptr;
+  sem_t dump_sem_{};
+  std::atomic<bool> closing_{false};
+  std::thread dumper_;
+
+  // Only async-signal-safe work here: the dump itself runs on `dumper_`.
+  static void OnDumpSignal(int) { if (dump_request_) sem_post(dump_request_); }
+#endif
+
+  static ThreadRing *&LocalRing() {
+    thread_local LocalHolder holder;
+    return holder.ring;
+  }
+
+  // A ring for the calling thread: a free one if any, so that threads 
+  // coming and going (a batch of VMs) do not grow the trace.
+  ThreadRing &AddThread() {
+    std::lock_guard<std::mutex> lock(lock_);
+    ThreadRing *ring = nullptr;
+    if (!free_.empty()) {
+      ring = free_.back();
+      free_.pop_back();
+    } else {
+      auto fresh = std::make_shared<ThreadRing>();
+      fresh->events = std::make_unique<Slot[]>(capacity_);
+      fresh->mask = capacity_ - 1;
+      rings_.push_back(fresh);
+      ring = fresh.get();
+    }
+
+    // Owners left with no events in the ring are dropped.
+    auto &owners = ring->owners;
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (!owners.empty() && owners.back().first == head) owners.pop_back();
+    size_t gone = 0;
+    while (gone + 1 < owners.size() && owners[gone + 1].first + ring->mask + 1 <= head) gone++;
+    owners.erase(owners.begin(), owners.begin() + gone);
+
+    const uint64_t tid = ++threads_;
+    owners.push_back(Owner{ head, tid, "thread " + std::to_string(tid) });
+    return *(LocalRing() = ring);
+  }
+
+  void Release(ThreadRing &ring) {
+    std::lock_guard<std::mutex> lock(lock_);
+    free_.push_back(&ring);
+  }
+
+  ThreadRing &Local() {
+    auto *ring = LocalRing();
+    return ring ? *ring : AddThread();
+  }
+
+  static void WriteEvent(std::ostream &out, const Event &event, uint64_t pid, uint64_t tid) {
+    static const char phases[] = { 'B', 'E', 'i', 'C' };
+    out << ",\n{\"name\":\"" << json_escape(event.name ? event.name : "?") << "\",\"ph\":\""
+        << phases[event.type & 3] << "\",\"ts\":" << event.time / 1000 << "." << std::setw(3) << std::setfill('0')
+        << event.time % 1000 << std::setfill(' ') << ",\"pid\":" << pid << ",\"tid\":" << tid;
+    if (event.type == TINYW_TRACE_INSTANT) out << ",\"s\":\"t\"";
+    if (event.type == TINYW_TRACE_COUNTER || (event.type == TINYW_TRACE_BEGIN && event.value))
+      out << ",\"args\":{\"value\":" << event.value << "}";
+    out << "}";
+  }
+
+public:
+  Tracer() = default;
+  Tracer(const Tracer&) = delete;
+  Tracer &operator=(const Tracer&) = delete;
+
+  ~Tracer() {
+#if !defined(_WIN32)
+    if (dumper_.joinable()) {
+      closing_ = true;
+      sem_post(&dump_sem_);
+      dumper_.join();
+    }
+#endif
+  }
+
+  static bool Enabled() {
+    return std::atomic_ref<uint32_t>(enabled_).load(std::memory_order_relaxed) != 0;
+  }
+
+  // What modules get through `attach_tracer`; null while tracing is off,
+  // so untraced modules do not even pay the flag load.
+  const tinyw_tracer *ABI() const { return Enabled() ? &abi_ : nullptr; }
+
+  // Turns tracing on, writing to `path`; `events` per thread are kept
+  // (rounded up to a power of two). Later calls only warn if they name
+  // another file: there is one trace per process.
+  void Start(const fs::path &path, uint64_t events = 65536) {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (Enabled()) {
+      if (path != path_) std::cerr << "> [i:warn]: already tracing to " << path_ << ", ignoring " << path << std::endl;
+      return;
+    }
+
+    path_ = path;
+    capacity_ = std::bit_ceil(std::max<uint64_t>(events, 16));
+    abi_ = tinyw_tracer{ .enabled = &enabled_, .event = [](uint32_t type, const char *name, int64_t value) {
+      Instance().Record(type, Instance().ModuleName(name), value);
+    } };
+
+#if !defined(_WIN32)
+    if (sem_init(&dump_sem_, 0, 0) == 0) {
+      dump_request_ = &dump_sem_;
+      dumper_ = std::thread([this] {
+        for (;;) {
+          while (sem_wait(&dump_sem_) != 0) {}
+          if (closing_) return;
+          Dump();
+        }
+      });
+
+      struct sigaction action{};
+      action.sa_handler = OnDumpSignal;
+      action.sa_flags = SA_RESTART;
+      sigemptyset(&action.sa_mask);
+      sigaction(SIGUSR1, &action, nullptr);
+    }
+#endif
+
+    std::atomic_ref<uint32_t>(enabled_).store(1, std::memory_order_release);
+  }
+
+  // The fence orders the last `head` store before the slot is overwritten: 
+  // a dump that copied any of the new fields then sees the new head.
+  void Record(uint32_t type, const char *name, int64_t value = 0) {
+    auto &ring = Local();
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    ring.events[head & ring.mask].Store(Event{
+      (std::chrono::steady_clock::now() - origin_).count(), name, value, type });
+    ring.head.store(head + 1, std::memory_order_release);
+  }
+
+  // A stable copy of `name`, for events named at run time.
+  const char *Intern(const std::string &name) {
+    std::lock_guard<std::mutex> lock(lock_);
+    return names_.insert(name).first->c_str();
+  }
+
+  // Module names live in libraries that may be unloaded before the dump:
+  // each thread maps the pointers it saw to interned copies, and compares
+  // the text again in case a later library reused an address.
+  const char *ModuleName(const char *name) {
+    if (!name) return nullptr;
+    thread_local std::unordered_map<const char*, const char*> seen;
+    auto &copy = seen[name];
+    if (!copy || std::strcmp(copy, name) != 0) copy = Intern(name);
+    return copy;
+  }
+
+  // Shown as the thread's track title.
+  void NameThread(const std::string &name) {
+    if (!Enabled()) return;
+    auto &ring = Local();
+    std::lock_guard<std::mutex> lock(lock_);
+    ring.owners.back().name = name;
+  }
+
+  // Rings keep being written while this runs: slots the writer reused
+  // before they were copied out are dropped, not reported torn.
+  std::string ToJSON() {
+    struct Snapshot {
+      std::shared_ptr<ThreadRing> ring;
+      std::vector<Owner> owners;
+      uint64_t head;    // read with the owners: later events may be a new owner's
+    };
+    std::vector<Snapshot> rings;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      for (const auto &ring : rings_) 
+        rings.push_back(Snapshot{ ring, ring->owners, ring->head.load(std::memory_order_acquire) });
+    }
+
+#if defined(_WIN32)
+    const uint64_t pid = 1;
+#else
+    const uint64_t pid = getpid();
+#endif
+
+    std::ostringstream out;
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+        << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":0,\"args\":{\"name\":\"tinyw\"}}";
+
+    std::vector<Event> events;
+    for (const auto &[ring, owners, head] : rings) {
+      const uint64_t capacity = ring->mask + 1;
+      const uint64_t first = head > capacity ? head - capacity : 0;
+      events.assign(head - first, Event{});
+      for (uint64_t i = first; i < head; i++) events[i - first] = ring->events[i & ring->mask].Load();
+
+      // The event being recorded right now may be overwriting one more slot.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      const uint64_t after = ring->head.load(std::memory_order_relaxed);
+      const uint64_t valid = std::max(first, after >= capacity ? after - capacity + 1 : 0);
+
+      for (size_t k = 0; k < owners.size(); k++) {
+        const uint64_t from = std::max(owners[k].first, valid);
+        const uint64_t to = k + 1 < owners.size() ? owners[k + 1].first : head;
+        if (from >= to && k + 1 < owners.size()) continue;
+
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << owners[k].tid
+            << ",\"args\":{\"name\":\"" << json_escape(owners[k].name) << "\"}}";
+        for (uint64_t i = from; i < to; i++) WriteEvent(out, events[i - first], pid, owners[k].tid);
+      }
+    }
+
+    out << "\n]}\n";
+    return out.str();
+  }
+
+  // Writes everything recorded so far; failures are reported, not thrown.
+  void Dump() {
+    if (!Enabled()) return;
+    try {
+      const auto json = ToJSON();
+      write_file_atomic(path_, json.data(), json.size(), fs::perms::unknown);
+      std::cerr << "> trace written to " << path_.string() << std::endl;
+    } catch (const std::exception &e) {
+      std::cerr << "> [i:warn]: cannot write trace to " << path_ << ": " << e.what() << std::endl;
+    }
+  }
+
+  // End of the process: a last dump, then recording stops.
+  void Finish() {
+    if (!Enabled()) return;
+#if !defined(_WIN32)
+    signal(SIGUSR1, SIG_IGN);
+    if (dumper_.joinable()) {
+      closing_ = true;
+      sem_post(&dump_sem_);
+      dumper_.join();
+    }
+#endif
+    Dump();
+    std::atomic_ref<uint32_t>(enabled_).store(0, std::memory_order_relaxed);
+  }
+
+  static Tracer &Instance() {
+    static Tracer instance;
+    return instance;
+  }
+};
+
+inline Tracer &tracer() { return Tracer::Instance(); }
+
+// Begin/end pair around a scope. `name` must outlive the trace (a literal,
+// or `tracer().Intern(...)`).
+class TraceSpan {
+  const char *name_ = nullptr;
+
+public:
+  explicit TraceSpan(const char *name, int64_t value = 0) {
+    if (!Tracer::Enabled()) return;
+    name_ = name;
+    tracer().Record(TINYW_TRACE_BEGIN, name, value);
+  }
+
+  ~TraceSpan() { if (name_) tracer().Record(TINYW_TRACE_END, name_); }
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan &operator=(const TraceSpan&) = delete;
+};
+
+TinyWDeclEnd